@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/common.hpp>
+
+// Matches the std430 layout of BVHNode in raytracing.frag (32 bytes).
+// Leaves have triangleCount > 0 and leftFirst is the first triangle, otherwise leftFirst is the left child
+// and the right child directly follows it.
+struct BVHNode {
+	glm::vec3 boundsMin;
+	int32_t leftFirst;
+	glm::vec3 boundsMax;
+	int32_t triangleCount;
+};
+static_assert(sizeof(BVHNode) == 32);
+
+// The shader traverses with a fixed size stack, so the depth has to be bounded
+constexpr int BVH_MAX_DEPTH = 31;
+constexpr int BVH_MAX_LEAF_SIZE = 4;
+constexpr int BVH_BIN_COUNT = 16;
+
+struct Bounds {
+	glm::vec3 min{std::numeric_limits<float>::max()};
+	glm::vec3 max{-std::numeric_limits<float>::max()};
+
+	void Grow(const glm::vec3 &point) {
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void Grow(const Bounds &bounds) {
+		min = glm::min(min, bounds.min);
+		max = glm::max(max, bounds.max);
+	}
+
+	[[nodiscard]] float Area() const {
+		const glm::vec3 extent = max - min;
+		if (extent.x < 0.0f) return 0.0f;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+};
+
+// Builds a binned SAH BVH over triangles [firstTriangle, firstTriangle + nTriangle) of the index buffer,
+// reordering those triangles in place, and appends the nodes. Returns the index of the root node.
+static int BuildBVH(std::span<const float> positions, std::span<uint32_t> indices, int firstTriangle, int nTriangle,
+	std::vector<BVHNode> &nodes)
+{
+	struct BuildTriangle {
+		Bounds bounds;
+		glm::vec3 centroid;
+	};
+	struct BuildEntry {
+		int node, first, count, depth;
+	};
+
+	auto position = [&](uint32_t vertex) {
+		return glm::vec3(positions[3 * vertex], positions[3 * vertex + 1], positions[3 * vertex + 2]);
+	};
+
+	std::vector<BuildTriangle> triangles(nTriangle);
+	for (int i = 0; i < nTriangle; ++i) {
+		const uint32_t *triangle = &indices[3 * (firstTriangle + i)];
+		for (int j = 0; j < 3; ++j)
+			triangles[i].bounds.Grow(position(triangle[j]));
+		triangles[i].centroid = (triangles[i].bounds.min + triangles[i].bounds.max) * 0.5f;
+	}
+	std::vector<int> order(nTriangle);
+	std::iota(order.begin(), order.end(), 0);
+
+	const int root = static_cast<int>(nodes.size());
+	nodes.push_back({});
+	std::vector<BuildEntry> stack{{root, 0, nTriangle, 0}};
+
+	while (!stack.empty()) {
+		const BuildEntry entry = stack.back();
+		stack.pop_back();
+
+		Bounds bounds, centroidBounds;
+		for (int i = entry.first; i < entry.first + entry.count; ++i) {
+			bounds.Grow(triangles[order[i]].bounds);
+			centroidBounds.Grow(triangles[order[i]].centroid);
+		}
+		nodes[entry.node].boundsMin = bounds.min;
+		nodes[entry.node].boundsMax = bounds.max;
+		nodes[entry.node].leftFirst = firstTriangle + entry.first;
+		nodes[entry.node].triangleCount = entry.count;
+
+		if (entry.count <= BVH_MAX_LEAF_SIZE || entry.depth >= BVH_MAX_DEPTH)
+			continue;
+
+		// Find the cheapest split plane by binning centroids along each axis
+		float bestCost = static_cast<float>(entry.count) * bounds.Area();
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			std::array<Bounds, BVH_BIN_COUNT> bins{};
+			std::array<int, BVH_BIN_COUNT> binCounts{};
+			const float scale = BVH_BIN_COUNT / extent;
+			for (int i = entry.first; i < entry.first + entry.count; ++i) {
+				const BuildTriangle &triangle = triangles[order[i]];
+				const int bin = std::min(BVH_BIN_COUNT - 1,
+					static_cast<int>((triangle.centroid[axis] - centroidBounds.min[axis]) * scale));
+				bins[bin].Grow(triangle.bounds);
+				binCounts[bin]++;
+			}
+
+			std::array<float, BVH_BIN_COUNT - 1> leftCost{};
+			Bounds left;
+			int leftCount = 0;
+			for (int i = 0; i < BVH_BIN_COUNT - 1; ++i) {
+				left.Grow(bins[i]);
+				leftCount += binCounts[i];
+				leftCost[i] = static_cast<float>(leftCount) * left.Area();
+			}
+			Bounds right;
+			int rightCount = 0;
+			for (int i = BVH_BIN_COUNT - 1; i > 0; --i) {
+				right.Grow(bins[i]);
+				rightCount += binCounts[i];
+				const float cost = leftCost[i - 1] + static_cast<float>(rightCount) * right.Area();
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		int split = entry.first + entry.count / 2;
+		if (bestAxis >= 0) {
+			const float scale = BVH_BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+			const auto middle = std::partition(order.begin() + entry.first, order.begin() + entry.first + entry.count,
+				[&](int i) {
+					const int bin = std::min(BVH_BIN_COUNT - 1,
+						static_cast<int>((triangles[i].centroid[bestAxis] - centroidBounds.min[bestAxis]) * scale));
+					return bin < bestBin;
+				});
+			split = static_cast<int>(middle - order.begin());
+		}
+		else if (entry.count <= 4 * BVH_MAX_LEAF_SIZE) {
+			// splitting is not worth it
+			continue;
+		}
+		if (split == entry.first || split == entry.first + entry.count)
+			split = entry.first + entry.count / 2;
+
+		const int left = static_cast<int>(nodes.size());
+		nodes.push_back({});
+		nodes.push_back({});
+		nodes[entry.node].leftFirst = left;
+		nodes[entry.node].triangleCount = 0;
+		stack.push_back({left, entry.first, split - entry.first, entry.depth + 1});
+		stack.push_back({left + 1, split, entry.first + entry.count - split, entry.depth + 1});
+	}
+
+	// Apply the leaf ordering to the index buffer
+	std::vector<uint32_t> reordered(3 * static_cast<size_t>(nTriangle));
+	for (int i = 0; i < nTriangle; ++i)
+		std::copy_n(&indices[3 * (firstTriangle + order[i])], 3, &reordered[3 * i]);
+	std::ranges::copy(reordered, indices.begin() + 3 * firstTriangle);
+	return root;
+}
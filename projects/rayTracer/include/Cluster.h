@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "BVH.h"
+#include "Geometry.h"
+#include "Mesh.h"
+
+// Largest BVH subtree that becomes a cluster, the unit of out-of-core residency
+constexpr int CLUSTER_MAX_TRIANGLES = 4096;
+
+// A self-contained BVH subtree with its own triangles and vertices. Cluster nodes and triangles are indexed
+// relative to the cluster and the triangles index its vertices, so a cluster can be placed anywhere in the pool.
+struct ClusterRecord {
+	uint32_t firstNode, nodeCount;
+	uint32_t firstTriangle, triangleCount;
+	uint32_t firstVertex, vertexCount;
+};
+
+// Top level nodes that reference a cluster, leftFirst is the cluster index
+constexpr int32_t CLUSTER_NODE = -1;
+
+// In the clustered layout every mesh BVH is cut into a top level that is always resident and clusters below it.
+// The top level nodes come first in the node stream, followed by the nodes of every cluster.
+static uint32_t TopNodeCount(const Geometry &geometry, std::span<const ClusterRecord> clusters) {
+	return clusters.empty() ? static_cast<uint32_t>(geometry.nodes.size()) : clusters.front().firstNode;
+}
+
+// Converts BVH-built geometry into the clustered layout, cutting each mesh BVH at the highest nodes with at most
+// CLUSTER_MAX_TRIANGLES triangles below them. Mesh and LOD root nodes are remapped to the top level.
+static void BuildClusters(const Geometry &geometry, const std::vector<std::shared_ptr<Mesh>> &meshes,
+	Geometry &clustered, std::vector<ClusterRecord> &clusters)
+{
+	// children are always allocated after their parent, so counting backwards sees them first
+	std::vector<int> subtreeTriangles(geometry.nodes.size());
+	for (size_t i = geometry.nodes.size(); i-- > 0;) {
+		const BVHNode &node = geometry.nodes[i];
+		subtreeTriangles[i] = node.triangleCount > 0 ? node.triangleCount :
+			subtreeTriangles[node.leftFirst] + subtreeTriangles[node.leftFirst + 1];
+	}
+
+	std::vector<BVHNode> topNodes, clusterNodes;
+	std::vector<uint32_t> clusterIndices;
+	std::vector<float> clusterPositions, clusterNormals, clusterTexcoords;
+
+	auto emitCluster = [&](int root) {
+		ClusterRecord cluster{};
+		cluster.firstNode = static_cast<uint32_t>(clusterNodes.size());
+		cluster.firstTriangle = static_cast<uint32_t>(clusterIndices.size() / 3);
+		cluster.triangleCount = static_cast<uint32_t>(subtreeTriangles[root]);
+		cluster.firstVertex = static_cast<uint32_t>(clusterPositions.size() / 3);
+
+		// A subtree's triangles are contiguous, they start at its first leaf
+		int firstTriangle = INT32_MAX;
+		std::vector<int> stack{root};
+		while (!stack.empty()) {
+			const BVHNode &node = geometry.nodes[stack.back()];
+			stack.pop_back();
+			if (node.triangleCount > 0)
+				firstTriangle = std::min(firstTriangle, node.leftFirst);
+			else
+				stack.insert(stack.end(), {node.leftFirst, node.leftFirst + 1});
+		}
+
+		std::vector<std::pair<int, uint32_t>> copies{{root, 0}};
+		clusterNodes.push_back({});
+		while (!copies.empty()) {
+			const auto [source, local] = copies.back();
+			copies.pop_back();
+			BVHNode node = geometry.nodes[source];
+			if (node.triangleCount > 0) {
+				node.leftFirst -= firstTriangle;
+			}
+			else {
+				const auto left = static_cast<uint32_t>(clusterNodes.size() - cluster.firstNode);
+				clusterNodes.insert(clusterNodes.end(), 2, BVHNode{});
+				copies.emplace_back(node.leftFirst, left);
+				copies.emplace_back(node.leftFirst + 1, left + 1);
+				node.leftFirst = static_cast<int32_t>(left);
+			}
+			clusterNodes[cluster.firstNode + local] = node;
+		}
+		cluster.nodeCount = static_cast<uint32_t>(clusterNodes.size()) - cluster.firstNode;
+
+		std::unordered_map<uint32_t, uint32_t> localVertex;
+		const auto triangles = geometry.indices.subspan(3 * static_cast<size_t>(firstTriangle), 3 * static_cast<size_t>(cluster.triangleCount));
+		for (const uint32_t vertex : triangles) {
+			const auto [it, inserted] = localVertex.try_emplace(vertex, static_cast<uint32_t>(localVertex.size()));
+			if (inserted) {
+				const auto position = geometry.positions.subspan(3 * static_cast<size_t>(vertex), 3);
+				const auto normal = geometry.normals.subspan(3 * static_cast<size_t>(vertex), 3);
+				clusterPositions.insert(clusterPositions.end(), position.begin(), position.end());
+				const auto texcoord = geometry.texcoords.subspan(2 * static_cast<size_t>(vertex), 2);
+				clusterNormals.insert(clusterNormals.end(), normal.begin(), normal.end());
+				clusterTexcoords.insert(clusterTexcoords.end(), texcoord.begin(), texcoord.end());
+			}
+			clusterIndices.push_back(it->second);
+		}
+		cluster.vertexCount = static_cast<uint32_t>(localVertex.size());
+		clusters.push_back(cluster);
+	};
+
+	// instances and shared LODs reference the same root
+	std::map<int, int> topRoots;
+	auto cut = [&](int root) {
+		const auto [it, inserted] = topRoots.try_emplace(root, static_cast<int>(topNodes.size()));
+		if (!inserted) return it->second;
+		topNodes.push_back({});
+
+		std::vector<std::pair<int, int>> stack{{root, it->second}};
+		while (!stack.empty()) {
+			const auto [source, top] = stack.back();
+			stack.pop_back();
+			BVHNode node = geometry.nodes[source];
+			if (subtreeTriangles[source] <= CLUSTER_MAX_TRIANGLES) {
+				node.leftFirst = static_cast<int32_t>(clusters.size());
+				node.triangleCount = CLUSTER_NODE;
+				emitCluster(source);
+			}
+			else {
+				const auto left = static_cast<int>(topNodes.size());
+				topNodes.insert(topNodes.end(), 2, BVHNode{});
+				stack.emplace_back(node.leftFirst, left);
+				stack.emplace_back(node.leftFirst + 1, left + 1);
+				node.leftFirst = left;
+			}
+			topNodes[top] = node;
+		}
+		return it->second;
+	};
+
+	for (const auto &mesh : meshes) {
+		mesh->rootNodeIndex = cut(mesh->rootNodeIndex);
+		for (MeshLOD &lod : mesh->lods)
+			lod.rootNodeIndex = cut(lod.rootNodeIndex);
+	}
+
+	for (ClusterRecord &cluster : clusters)
+		cluster.firstNode += static_cast<uint32_t>(topNodes.size());
+	clustered.nodeData = std::move(topNodes);
+	clustered.nodeData.insert(clustered.nodeData.end(), clusterNodes.begin(), clusterNodes.end());
+	clustered.indexData = std::move(clusterIndices);
+	clustered.positionData = std::move(clusterPositions);
+	clustered.normalData = std::move(clusterNormals);
+	clustered.texcoordData = std::move(clusterTexcoords);
+	clustered.ViewOwnedData();
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "glad/glad.h"
+#include "Cluster.h"
+#include "Geometry.h"
+#include "SSBO.h"
+
+// Matches ClusterState in raytracing.frag
+struct ClusterState {
+	// root of the resident copy in the node buffer, -1 while the cluster isn't resident
+	int32_t rootNodeIndex;
+	// residency frame in which a ray last reached the cluster, written by the shader
+	uint32_t lastUsed;
+};
+
+// Pages the clusters of a clustered scene through a fixed number of equally sized slots in the geometry SSBOs,
+// behind the always resident top level nodes. Rays stamp every cluster they reach. The ones they found missing
+// are loaded once their stamps are read back, taking the slots of the least recently used clusters. The stamps are
+// copied aside behind a fence and read a frame or more later, so neither side waits for the other.
+class ClusterResidency {
+public:
+	ClusterResidency(const Geometry &geometry, std::span<const ClusterRecord> clusters, size_t poolBytes,
+		SSBO &positionSSBO, SSBO &normalSSBO, SSBO &texcoordSSBO, SSBO &indexSSBO, SSBO &nodeSSBO, SSBO &clusterSSBO) :
+		geometry(geometry), clusters(clusters), topNodeCount(TopNodeCount(geometry, clusters)),
+		positionSSBO(positionSSBO), normalSSBO(normalSSBO), texcoordSSBO(texcoordSSBO), indexSSBO(indexSSBO), nodeSSBO(nodeSSBO), clusterSSBO(clusterSSBO)
+	{
+		for (const ClusterRecord &cluster : clusters) {
+			slotNodes = std::max(slotNodes, static_cast<size_t>(cluster.nodeCount));
+			slotTriangles = std::max(slotTriangles, static_cast<size_t>(cluster.triangleCount));
+			slotVertices = std::max(slotVertices, static_cast<size_t>(cluster.vertexCount));
+		}
+		const size_t slotBytes = slotNodes * sizeof(BVHNode) + slotTriangles * 3 * sizeof(uint32_t) +
+			slotVertices * 8 * sizeof(float);
+		slotCount = std::clamp<size_t>(poolBytes / std::max<size_t>(slotBytes, 1), 1, std::max<size_t>(clusters.size(), 1));
+		slotCluster.assign(slotCount, -1);
+		clusterSlot.assign(clusters.size(), -1);
+		states.assign(clusters.size(), {-1, 0});
+
+		// Allocate the whole pool up front, the top level sits in front of the node slots
+		positionSSBO.BufferData(nullptr, slotCount * slotVertices * 3 * sizeof(float));
+		normalSSBO.BufferData(nullptr, slotCount * slotVertices * 3 * sizeof(float));
+		texcoordSSBO.BufferData(nullptr, slotCount * slotVertices * 2 * sizeof(float));
+		indexSSBO.BufferData(nullptr, slotCount * slotTriangles * 3 * sizeof(uint32_t));
+		nodeSSBO.BufferData(nullptr, (topNodeCount + slotCount * slotNodes) * sizeof(BVHNode));
+		nodeSSBO.BufferSubData(0, geometry.nodes.data(), topNodeCount * sizeof(BVHNode));
+		clusterSSBO.BufferData(states.data(), states.size() * sizeof(ClusterState));
+
+		glGenBuffers(1, &readbackBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(states.size() * sizeof(ClusterState)), nullptr, GL_STREAM_READ);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	~ClusterResidency() {
+		if (readbackFence) glDeleteSync(readbackFence);
+		glDeleteBuffers(1, &readbackBuffer);
+	}
+
+	ClusterResidency(const ClusterResidency&) = delete;
+	ClusterResidency& operator=(const ClusterResidency&) = delete;
+
+	// Residency frame the next frame's rays stamp the clusters with
+	[[nodiscard]] uint32_t Frame() const { return frame; }
+	[[nodiscard]] size_t SlotCount() const { return slotCount; }
+	[[nodiscard]] size_t ResidentCount() const { return static_cast<size_t>(std::ranges::count_if(slotCluster, [](int c) { return c >= 0; })); }
+	[[nodiscard]] size_t ClusterCount() const { return clusters.size(); }
+	[[nodiscard]] size_t MissingCount() const { return missing; }
+
+	// Loads the clusters missing in the last frame whose stamps arrived, at most loadBudget bytes, then copies the
+	// stamps of the frame just submitted aside. Returns true if any became resident, the deferred rays only see
+	// them from now on.
+	bool Update(size_t loadBudget) {
+		// the GPU hasn't caught up with the previous copy yet, its frames keep stamping
+		if (readbackFence && glClientWaitSync(readbackFence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			++frame;
+			return false;
+		}
+
+		bool loaded = false;
+		if (readbackFence) {
+			glDeleteSync(readbackFence);
+			glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, static_cast<GLsizeiptr>(states.size() * sizeof(ClusterState)), states.data());
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			loaded = LoadMissing(loadBudget);
+		}
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_COPY_READ_BUFFER, clusterSSBO.Handle());
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(states.size() * sizeof(ClusterState)));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		// the copy holds the stamps of every frame up to this one
+		readbackFrame = frame;
+		++frame;
+		return loaded;
+	}
+
+private:
+	// Loads the clusters the read back frame reached but found missing, evicting the least recently used ones
+	bool LoadMissing(size_t loadBudget) {
+		std::vector<uint32_t> requests;
+		for (uint32_t i = 0; i < states.size(); ++i)
+			if (states[i].lastUsed == readbackFrame && clusterSlot[i] < 0)
+				requests.push_back(i);
+		missing = requests.size();
+
+		// Free slots first, then the least recently used, never one the read back frame needed
+		std::vector<uint32_t> victims(slotCount);
+		std::iota(victims.begin(), victims.end(), 0);
+		auto lastUsed = [&](uint32_t slot) { return slotCluster[slot] < 0 ? 0 : states[slotCluster[slot]].lastUsed; };
+		std::ranges::sort(victims, {}, lastUsed);
+
+		size_t loaded = 0, victim = 0;
+		for (const uint32_t cluster : requests) {
+			if (loaded >= loadBudget || victim == victims.size() || (slotCluster[victims[victim]] >= 0 && lastUsed(victims[victim]) >= readbackFrame))
+				break;
+			const uint32_t slot = victims[victim++];
+			if (slotCluster[slot] >= 0) {
+				clusterSlot[slotCluster[slot]] = -1;
+				SetRoot(slotCluster[slot], -1);
+			}
+			loaded += Load(cluster, slot);
+		}
+		return loaded > 0;
+	}
+
+	// Only writes the root, lastUsed belongs to the shader
+	void SetRoot(int cluster, int32_t rootNodeIndex) const {
+		clusterSSBO.BufferSubData(cluster * sizeof(ClusterState) + offsetof(ClusterState, rootNodeIndex), &rootNodeIndex, sizeof(int32_t));
+	}
+
+	// Copies a cluster into a slot, moving its relative indices to where the slot sits in the pool
+	size_t Load(uint32_t cluster, uint32_t slot) {
+		const ClusterRecord &record = clusters[cluster];
+		const auto nodeBase = static_cast<int32_t>(topNodeCount + slot * slotNodes);
+		const auto triangleBase = static_cast<int32_t>(slot * slotTriangles);
+		const auto vertexBase = static_cast<uint32_t>(slot * slotVertices);
+
+		std::vector<BVHNode> nodes(geometry.nodes.begin() + record.firstNode, geometry.nodes.begin() + record.firstNode + record.nodeCount);
+		for (BVHNode &node : nodes)
+			node.leftFirst += node.triangleCount > 0 ? triangleBase : nodeBase;
+		std::vector<uint32_t> indices(geometry.indices.begin() + 3 * static_cast<size_t>(record.firstTriangle),
+			geometry.indices.begin() + 3 * static_cast<size_t>(record.firstTriangle + record.triangleCount));
+		for (uint32_t &index : indices)
+			index += vertexBase;
+		const auto positions = geometry.positions.subspan(3 * static_cast<size_t>(record.firstVertex), 3 * static_cast<size_t>(record.vertexCount));
+		const auto normals = geometry.normals.subspan(3 * static_cast<size_t>(record.firstVertex), 3 * static_cast<size_t>(record.vertexCount));
+		const auto texcoords = geometry.texcoords.subspan(2 * static_cast<size_t>(record.firstVertex), 2 * static_cast<size_t>(record.vertexCount));
+
+		nodeSSBO.BufferSubData(nodeBase * sizeof(BVHNode), nodes.data(), nodes.size() * sizeof(BVHNode));
+		indexSSBO.BufferSubData(triangleBase * 3 * sizeof(uint32_t), indices.data(), indices.size() * sizeof(uint32_t));
+		positionSSBO.BufferSubData(vertexBase * 3 * sizeof(float), positions.data(), positions.size_bytes());
+		normalSSBO.BufferSubData(vertexBase * 3 * sizeof(float), normals.data(), normals.size_bytes());
+		texcoordSSBO.BufferSubData(vertexBase * 2 * sizeof(float), texcoords.data(), texcoords.size_bytes());
+
+		slotCluster[slot] = static_cast<int>(cluster);
+		clusterSlot[cluster] = static_cast<int>(slot);
+		SetRoot(static_cast<int>(cluster), nodeBase);
+		return nodes.size() * sizeof(BVHNode) + indices.size() * sizeof(uint32_t) + positions.size_bytes() + normals.size_bytes() +
+			texcoords.size_bytes();
+	}
+
+	const Geometry &geometry;
+	std::span<const ClusterRecord> clusters;
+	const uint32_t topNodeCount;
+	SSBO &positionSSBO, &normalSSBO, &texcoordSSBO, &indexSSBO, &nodeSSBO, &clusterSSBO;
+
+	size_t slotNodes = 0, slotTriangles = 0, slotVertices = 0, slotCount = 0;
+	std::vector<int> slotCluster, clusterSlot;
+	std::vector<ClusterState> states;
+	// starts above the zero every cluster is stamped with initially
+	uint32_t frame = 1;
+	// the stamps copied aside, valid once the fence signals, and the last frame they include
+	GLuint readbackBuffer = 0;
+	GLsync readbackFence = nullptr;
+	uint32_t readbackFrame = 0;
+	size_t missing = 0;
+};
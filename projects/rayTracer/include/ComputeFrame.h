@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+
+#include "glad/glad.h"
+#include "Texture.h"
+
+// What the compute renderers need to know about the frame, the same uniforms the fragment shader gets
+struct ComputeFrame {
+	glm::mat4 invProjMatrix, invViewMatrix;
+	GLuint frameCount, residencyFrame;
+	int raysPerPixel, rayCapacity;
+	float lodErrorScale;
+	glm::ivec2 environmentSize;
+	float environmentStrength;
+	float lightPower;
+	std::array<GLint, TEXTURE_BUCKET_COUNT> textureUnits;
+	GLint environmentUnit;
+	// the image the resampled lighting's reservoirs are laid out for, 0 while it's off
+	glm::ivec2 reservoirSize;
+};
+
+// Sets the frame's uniforms on a compute program, uniforms it doesn't use are skipped by GL
+static void SetFrameUniforms(GLuint program, const ComputeFrame &frame, glm::ivec2 imageSize) {
+	glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "InvProjMatrix"), 1, false, &frame.invProjMatrix[0][0]);
+	glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "InvViewMatrix"), 1, false, &frame.invViewMatrix[0][0]);
+	glProgramUniform1ui(program, glGetUniformLocation(program, "FrameCount"), frame.frameCount);
+	glProgramUniform1ui(program, glGetUniformLocation(program, "ResidencyFrame"), frame.residencyFrame);
+	glProgramUniform1i(program, glGetUniformLocation(program, "NumRaysPerPixel"), frame.raysPerPixel);
+	glProgramUniform1i(program, glGetUniformLocation(program, "RayCapacity"), frame.rayCapacity);
+	glProgramUniform1f(program, glGetUniformLocation(program, "LodErrorScale"), frame.lodErrorScale);
+	glProgramUniform2iv(program, glGetUniformLocation(program, "EnvironmentSize"), 1, &frame.environmentSize[0]);
+	glProgramUniform1f(program, glGetUniformLocation(program, "EnvironmentStrength"), frame.environmentStrength);
+	glProgramUniform1f(program, glGetUniformLocation(program, "LightPower"), frame.lightPower);
+	glProgramUniform1iv(program, glGetUniformLocation(program, "TextureBuckets"), TEXTURE_BUCKET_COUNT, frame.textureUnits.data());
+	glProgramUniform1i(program, glGetUniformLocation(program, "EnvironmentMap"), frame.environmentUnit);
+	glProgramUniform2iv(program, glGetUniformLocation(program, "ReservoirSize"), 1, &frame.reservoirSize[0]);
+	glProgramUniform2iv(program, glGetUniformLocation(program, "ImageSize"), 1, &imageSize[0]);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/vec2.hpp>
+
+#include "glad/glad.h"
+#include "ShaderProgram.h"
+
+// Must match atrous.comp
+constexpr int DENOISE_GROUP_SIZE = 8;
+
+// Edge-avoiding a-trous filter settings. Every pass doubles the distance between the filter's taps, colorPhi is
+// how far apart colours may be in the first pass and halves with every pass after it.
+struct DenoiseSettings {
+	bool enabled = false;
+	int passes = 5;
+	float colorPhi = 1.0f;
+	float albedoPhi = 0.01f;
+	float depthPhi = 0.02f;
+	float normalPower = 64.0f;
+};
+
+// Filters the accumulation for display, steered by the first hits' position, normal and albedo so edges stay sharp.
+// The accumulation itself is left alone, it keeps converging underneath.
+class Denoiser {
+public:
+	Denoiser(std::vector<const char*> paths, glm::ivec2 imageSize) : paths(std::move(paths)), imageSize(imageSize)
+	{
+		glGenTextures(2, targets.data());
+		for (const GLuint target : targets) {
+			glBindTexture(GL_TEXTURE_2D, target);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, imageSize.x, imageSize.y);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		Rebuild();
+		build->Poll(true);
+		const bool built = SwapBuiltPrograms();
+		assert(built);
+	}
+
+	~Denoiser() {
+		glDeleteProgram(program);
+		glDeleteTextures(2, targets.data());
+	}
+
+	Denoiser(const Denoiser&) = delete;
+	Denoiser& operator=(const Denoiser&) = delete;
+
+	// The sources of the program, for watching them
+	[[nodiscard]] const std::vector<const char*>& Paths() const { return paths; }
+
+	// Starts building the program again in the background, the running one keeps filtering until it linked
+	void Rebuild() {
+		build = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_COMPUTE_SHADER, paths, {}}}, "resources/cache/atrous.rtprogram");
+	}
+
+	// Swaps the rebuilt program in once it is done, keeping the running one if it failed.
+	// Returns true if the program was swapped.
+	bool SwapBuiltPrograms() {
+		if (!build) return false;
+		const ProgramStatus status = build->Poll();
+		if (status == ProgramStatus::PENDING) return false;
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(program);
+			program = build->Take();
+		}
+		else std::cout << "Failed to build the denoise shader, keeping the previous one:\n" << build->Log() << std::endl;
+		build.reset();
+		return status == ProgramStatus::READY;
+	}
+
+	// Filters the RGBA32F accumulation of sums and counts. Returns the texture holding the filtered colour,
+	// with a count of 1 so it displays like the accumulation.
+	GLuint Denoise(GLuint accumulation, GLuint firstHit, GLuint firstHitNormal, GLuint firstHitAlbedo, const DenoiseSettings &settings) {
+		glProgramUniform2iv(program, glGetUniformLocation(program, "ImageSize"), 1, &imageSize[0]);
+		glProgramUniform1f(program, glGetUniformLocation(program, "AlbedoPhi"), settings.albedoPhi);
+		glProgramUniform1f(program, glGetUniformLocation(program, "DepthPhi"), settings.depthPhi);
+		glProgramUniform1f(program, glGetUniformLocation(program, "NormalPower"), settings.normalPower);
+		glBindImageTexture(2, firstHit, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, firstHitNormal, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		glBindImageTexture(4, firstHitAlbedo, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		glUseProgram(program);
+
+		GLuint source = accumulation;
+		for (int pass = 0; pass < settings.passes; ++pass) {
+			const GLuint destination = targets[pass % 2];
+			glProgramUniform1i(program, glGetUniformLocation(program, "StepSize"), 1 << pass);
+			glProgramUniform1f(program, glGetUniformLocation(program, "ColorPhi"), std::ldexp(settings.colorPhi, -pass));
+			glBindImageTexture(0, source, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+			glBindImageTexture(1, destination, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+			glDispatchCompute((imageSize.x + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE, (imageSize.y + DENOISE_GROUP_SIZE - 1) / DENOISE_GROUP_SIZE, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+			source = destination;
+		}
+		glUseProgram(0);
+		return source;
+	}
+
+private:
+	const std::vector<const char*> paths;
+	const glm::ivec2 imageSize;
+	GLuint program = 0;
+	std::unique_ptr<ProgramBuild> build;
+
+	// the passes take turns writing one and reading the other
+	std::array<GLuint, 2> targets{};
+};
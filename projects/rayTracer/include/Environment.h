@@ -0,0 +1,153 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/vec3.hpp>
+
+// Matches AliasEntry in raytracing.frag
+struct AliasEntry {
+	// probability of keeping the entry instead of taking its alias
+	float threshold;
+	int32_t alias;
+	// the entry's probability relative to a uniform choice, for the sample's pdf
+	float pdf;
+};
+
+// An equirectangular HDR environment, rows from the top (+y) down, with a 2D alias table over its texels:
+// a marginal table choosing the row, followed by a conditional table per row choosing the column.
+struct Environment {
+	int width = 0, height = 0;
+	std::vector<glm::vec3> radiance;
+	// height marginal entries, then width conditional entries per row
+	std::vector<AliasEntry> aliasTable;
+};
+
+// Vose's alias method, entries must hold weights.size() entries
+static void BuildAliasTable(std::span<const float> weights, std::span<AliasEntry> entries) {
+	const size_t n = weights.size();
+	const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (uint32_t i = 0; i < n; ++i) {
+		scaled[i] = total > 0.0 ? weights[i] * static_cast<double>(n) / total : 1.0;
+		entries[i] = {1.0f, static_cast<int32_t>(i), static_cast<float>(scaled[i])};
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		const uint32_t less = small.back(), more = large.back();
+		small.pop_back();
+		entries[less].threshold = static_cast<float>(scaled[less]);
+		entries[less].alias = static_cast<int32_t>(more);
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+	// whatever is left only differs from 1 by rounding
+}
+
+// Reads a Radiance .hdr (RGBE) image, flat or with new style run length encoded scanlines
+static bool LoadHDR(const char *filePath, Environment &environment) {
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open()) return false;
+
+	std::string line;
+	std::getline(file, line);
+	if (!line.starts_with("#?")) return false;
+	while (std::getline(file, line) && !line.empty())
+		if (line.starts_with("FORMAT=") && line != "FORMAT=32-bit_rle_rgbe") return false;
+	std::getline(file, line);
+	std::istringstream resolution(line);
+	std::string y, x;
+	int width, height;
+	// only the standard orientation, rows from the top, left to right
+	if (!(resolution >> y >> height >> x >> width) || y != "-Y" || x != "+X" || width <= 0 || height <= 0)
+		return false;
+
+	std::vector<uint8_t> rgbe(4 * static_cast<size_t>(width) * height);
+	std::vector<uint8_t> scanline(4 * static_cast<size_t>(width));
+	for (int row = 0; row < height; ++row) {
+		uint8_t *out = &rgbe[4 * static_cast<size_t>(row) * width];
+		uint8_t start[4];
+		if (!file.read(reinterpret_cast<char*>(start), 4)) return false;
+		if (width < 8 || width > 0x7fff || start[0] != 2 || start[1] != 2 || (start[2] << 8 | start[3]) != width) {
+			// flat scanline
+			std::copy_n(start, 4, out);
+			if (!file.read(reinterpret_cast<char*>(out + 4), 4 * (static_cast<std::streamsize>(width) - 1))) return false;
+			continue;
+		}
+		// each channel is run length encoded on its own
+		for (int channel = 0; channel < 4; ++channel) {
+			uint8_t *values = &scanline[static_cast<size_t>(channel) * width];
+			for (int i = 0; i < width;) {
+				const int count = file.get();
+				if (count <= 0) return false;
+				if (count > 128) {
+					const int value = file.get();
+					if (value < 0 || i + count - 128 > width) return false;
+					std::fill_n(values + i, count - 128, static_cast<uint8_t>(value));
+					i += count - 128;
+				}
+				else {
+					if (i + count > width || !file.read(reinterpret_cast<char*>(values + i), count)) return false;
+					i += count;
+				}
+			}
+		}
+		for (int i = 0; i < width; ++i)
+			for (int channel = 0; channel < 4; ++channel)
+				out[4 * i + channel] = scanline[static_cast<size_t>(channel) * width + i];
+	}
+
+	environment.width = width;
+	environment.height = height;
+	environment.radiance.resize(static_cast<size_t>(width) * height);
+	for (size_t i = 0; i < environment.radiance.size(); ++i) {
+		const uint8_t *texel = &rgbe[4 * i];
+		const float scale = texel[3] > 0 ? std::ldexp(1.0f, texel[3] - (128 + 8)) : 0.0f;
+		environment.radiance[i] = glm::vec3(texel[0], texel[1], texel[2]) * scale;
+	}
+	return true;
+}
+
+// Builds the alias table sampling texels proportional to their luminance times the solid angle they cover.
+// Rows are independent and are built in parallel.
+static void BuildEnvironmentAliasTable(Environment &environment) {
+	const int width = environment.width, height = environment.height;
+	environment.aliasTable.resize(static_cast<size_t>(height) * (width + 1));
+	std::vector<float> rowWeights(height);
+
+	auto buildRows = [&](int firstRow, int lastRow) {
+		std::vector<float> weights(width);
+		for (int row = firstRow; row < lastRow; ++row) {
+			// texels shrink towards the poles
+			const float sinTheta = std::sin((static_cast<float>(row) + 0.5f) / static_cast<float>(height) * 3.14159265f);
+			for (int column = 0; column < width; ++column) {
+				const glm::vec3 &radiance = environment.radiance[static_cast<size_t>(row) * width + column];
+				weights[column] = (0.2126f * radiance.r + 0.7152f * radiance.g + 0.0722f * radiance.b) * sinTheta;
+			}
+			rowWeights[row] = std::accumulate(weights.begin(), weights.end(), 0.0f);
+			BuildAliasTable(weights, std::span(environment.aliasTable).subspan(height + static_cast<size_t>(row) * width, width));
+		}
+	};
+	const int threadCount = static_cast<int>(std::clamp(std::thread::hardware_concurrency(), 1u, 64u));
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; ++i)
+		threads.emplace_back(buildRows, height * i / threadCount, height * (i + 1) / threadCount);
+	for (std::thread &thread : threads)
+		thread.join();
+
+	BuildAliasTable(rowWeights, std::span(environment.aliasTable).first(height));
+	// a texel's pdf relative to a uniform choice over all texels is its row's times its own
+	for (int row = 0; row < height; ++row)
+		for (int column = 0; column < width; ++column)
+			environment.aliasTable[height + static_cast<size_t>(row) * width + column].pdf *= environment.aliasTable[row].pdf;
+}
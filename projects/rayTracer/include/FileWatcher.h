@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Reports which of the watched files changed since the last Poll. On Linux inotify watches their directories,
+// as editors often save by writing a new file and renaming it over the old one. Elsewhere the modification
+// times are compared a few times a second.
+class FileWatcher {
+public:
+	FileWatcher() {
+#ifdef __linux__
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	}
+
+	~FileWatcher() {
+#ifdef __linux__
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	void Watch(const std::string &path) {
+		const std::filesystem::path absolute = std::filesystem::absolute(path).lexically_normal();
+		if (!files.try_emplace(absolute.string(), path).second) return;
+#ifdef __linux__
+		const std::string directory = absolute.parent_path().string();
+		if (fd < 0 || directories.contains(directory)) return;
+		const int watch = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watch >= 0) {
+			directories.insert(directory);
+			watches[watch] = directory;
+		}
+#else
+		modifiedTimes[absolute.string()] = ModifiedTime(absolute);
+#endif
+	}
+
+	// The changed files, as they were passed to Watch
+	std::vector<std::string> Poll() {
+		std::set<std::string> changed;
+#ifdef __linux__
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while (fd >= 0 && (length = read(fd, buffer, sizeof(buffer))) > 0) {
+			for (const char *event = buffer; event < buffer + length;) {
+				const auto *info = reinterpret_cast<const inotify_event*>(event);
+				const auto directory = watches.find(info->wd);
+				if (info->len > 0 && directory != watches.end()) {
+					const auto file = files.find((std::filesystem::path(directory->second) / info->name).string());
+					if (file != files.end()) changed.insert(file->second);
+				}
+				event += sizeof(inotify_event) + info->len;
+			}
+		}
+#else
+		const auto now = std::chrono::steady_clock::now();
+		if (now - lastPoll < std::chrono::milliseconds(250)) return {};
+		lastPoll = now;
+		for (const auto &[absolute, path] : files) {
+			const auto time = ModifiedTime(absolute);
+			if (time != modifiedTimes[absolute]) {
+				modifiedTimes[absolute] = time;
+				changed.insert(path);
+			}
+		}
+#endif
+		return {changed.begin(), changed.end()};
+	}
+
+private:
+	// absolute path -> the path it was watched as
+	std::map<std::string, std::string> files;
+#ifdef __linux__
+	int fd = -1;
+	std::set<std::string> directories;
+	std::map<int, std::string> watches;
+#else
+	static std::filesystem::file_time_type ModifiedTime(const std::filesystem::path &path) {
+		std::error_code error;
+		return std::filesystem::last_write_time(path, error);
+	}
+
+	std::map<std::string, std::filesystem::file_time_type> modifiedTimes;
+	std::chrono::steady_clock::time_point lastPoll;
+#endif
+};
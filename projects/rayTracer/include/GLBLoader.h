@@ -0,0 +1,266 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/ext/matrix_transform.hpp>
+
+#include "Geometry.h"
+#include "json.hpp"
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "ShaderStructs.h"
+
+constexpr uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+constexpr uint32_t GLB_JSON_CHUNK = 0x4E4F534A;
+constexpr uint32_t GLB_BIN_CHUNK = 0x004E4942;
+
+constexpr int GLTF_UNSIGNED_BYTE = 5121;
+constexpr int GLTF_UNSIGNED_SHORT = 5123;
+constexpr int GLTF_UNSIGNED_INT = 5125;
+constexpr int GLTF_FLOAT = 5126;
+constexpr int GLTF_TRIANGLES = 4;
+
+// An accessor resolved to a pointer into the mapped binary chunk
+struct GLBAccessor {
+	const std::byte *data = nullptr;
+	size_t count = 0, stride = 0;
+	int componentType = 0;
+};
+
+static GLBAccessor ReadGLBAccessor(const nlohmann::json &gltf, std::span<const std::byte> bin, int index) {
+	static const std::map<std::string, size_t> components{{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4}};
+	const auto &accessor = gltf["accessors"][index];
+	GLBAccessor result;
+	result.count = accessor["count"].get<size_t>();
+	result.componentType = accessor["componentType"].get<int>();
+	// sparse and buffer-less accessors are not supported
+	if (!accessor.contains("bufferView"))
+		return {};
+
+	const auto &bufferView = gltf["bufferViews"][accessor["bufferView"].get<int>()];
+	if (bufferView.value("buffer", 0) != 0)
+		return {};
+	const size_t componentSize = result.componentType == GLTF_UNSIGNED_BYTE ? 1 : result.componentType == GLTF_UNSIGNED_SHORT ? 2 : 4;
+	const size_t elementSize = componentSize * components.at(accessor["type"].get<std::string>());
+	const size_t offset = bufferView.value("byteOffset", size_t{0}) + accessor.value("byteOffset", size_t{0});
+	result.stride = bufferView.value("byteStride", elementSize);
+	if (result.count > 0 && offset + (result.count - 1) * result.stride + elementSize > bin.size())
+		return {};
+	result.data = bin.data() + offset;
+	return result;
+}
+
+// Appends a float VECn accessor, tightly packed views are copied in one go
+static void AppendGLBFloats(const GLBAccessor &accessor, size_t components, std::vector<float> &out) {
+	const size_t start = out.size();
+	out.resize(start + components * accessor.count);
+	if (accessor.stride == components * sizeof(float)) {
+		std::memcpy(&out[start], accessor.data, accessor.count * accessor.stride);
+		return;
+	}
+	for (size_t i = 0; i < accessor.count; ++i)
+		std::memcpy(&out[start + components * i], accessor.data + i * accessor.stride, components * sizeof(float));
+}
+
+static glm::mat4 GetGLBNodeTransform(const nlohmann::json &node) {
+	if (node.contains("matrix")) {
+		const auto matrix = node["matrix"].get<std::vector<float>>();
+		return glm::make_mat4(matrix.data());
+	}
+	const auto translation = node.value("translation", std::vector<float>{0, 0, 0});
+	const auto rotation = node.value("rotation", std::vector<float>{0, 0, 0, 1});
+	const auto scale = node.value("scale", std::vector<float>{1, 1, 1});
+	return translate(glm::mat4(1.0f), glm::make_vec3(translation.data())) *
+		mat4_cast(glm::quat(rotation[3], rotation[0], rotation[1], rotation[2])) *
+		glm::scale(glm::mat4(1.0f), glm::make_vec3(scale.data()));
+}
+
+static std::shared_ptr<Material> LoadGLBMaterial(const nlohmann::json &material, int index) {
+	const auto pbr = material.value("pbrMetallicRoughness", nlohmann::json::object());
+	const auto baseColor = pbr.value("baseColorFactor", std::vector<float>{1, 1, 1, 1});
+	const auto emissive = material.value("emissiveFactor", std::vector<float>{0, 0, 0});
+	const auto extensions = material.value("extensions", nlohmann::json::object());
+
+	float emissionStrength = emissive[0] + emissive[1] + emissive[2] > 0.0f ? 1.0f : 0.0f;
+	if (extensions.contains("KHR_materials_emissive_strength"))
+		emissionStrength = extensions["KHR_materials_emissive_strength"].value("emissiveStrength", 1.0f);
+	// an ior of 0 marks opaque materials
+	float ior = 0.0f;
+	if (extensions.contains("KHR_materials_transmission") &&
+		extensions["KHR_materials_transmission"].value("transmissionFactor", 0.0f) > 0.0f)
+		ior = extensions.contains("KHR_materials_ior") ? extensions["KHR_materials_ior"].value("ior", 1.5f) : 1.5f;
+
+	return std::make_shared<Material>(Material{
+		{baseColor[0], baseColor[1], baseColor[2]},
+		{emissive[0], emissive[1], emissive[2]},
+		emissionStrength,
+		pbr.value("roughnessFactor", 1.0f),
+		pbr.value("metallicFactor", 1.0f),
+		ior,
+		material.value("name", "material " + std::to_string(index)),
+		index
+	});
+}
+
+// Appends the triangles of every mesh primitive in the GLB's default scene to the geometry. Each node that
+// references a mesh becomes one Mesh per primitive, carrying the node's world transform, and nodes sharing a
+// mesh share its triangles. glTF materials are appended to the material list.
+static std::vector<std::shared_ptr<Mesh>> loadGLB(const char* filePath, Geometry *geometry,
+	std::vector<std::shared_ptr<Material>> *materials) {
+	const MappedFile file(filePath);
+	assert(file.IsOpen());
+
+	uint32_t header[3];
+	if (file.Size() < sizeof(header) + 8) return {};
+	std::memcpy(header, file.Data(), sizeof(header));
+	if (header[0] != GLB_MAGIC || header[1] != 2) return {};
+
+	// Locate the JSON and BIN chunks
+	std::span<const std::byte> json, bin;
+	for (size_t offset = sizeof(header); offset + 8 <= file.Size();) {
+		uint32_t chunk[2];
+		std::memcpy(chunk, file.Data() + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (offset + chunk[0] > file.Size()) break;
+		if (chunk[1] == GLB_JSON_CHUNK) json = {file.Data() + offset, chunk[0]};
+		else if (chunk[1] == GLB_BIN_CHUNK) bin = {file.Data() + offset, chunk[0]};
+		offset += chunk[0];
+	}
+	const auto gltf = nlohmann::json::parse(
+		reinterpret_cast<const char*>(json.data()), reinterpret_cast<const char*>(json.data() + json.size()));
+
+	const int firstMaterial = static_cast<int>(materials->size());
+	for (const auto &material : gltf.value("materials", nlohmann::json::array()))
+		materials->push_back(LoadGLBMaterial(material, static_cast<int>(materials->size())));
+	int defaultMaterial = -1;
+
+	struct Primitive {
+		int firstTriangleIndex, nTriangle, materialIndex;
+	};
+	// glTF mesh -> its primitives' triangle ranges, loaded on first use
+	std::map<int, std::vector<Primitive>> loadedMeshes;
+
+	auto loadPrimitives = [&](int meshIndex) -> const std::vector<Primitive>& {
+		const auto [it, inserted] = loadedMeshes.try_emplace(meshIndex);
+		if (!inserted) return it->second;
+
+		for (const auto &primitive : gltf["meshes"][meshIndex]["primitives"]) {
+			const auto &attributes = primitive["attributes"];
+			if (primitive.value("mode", GLTF_TRIANGLES) != GLTF_TRIANGLES || !attributes.contains("POSITION"))
+				continue;
+			const GLBAccessor positions = ReadGLBAccessor(gltf, bin, attributes["POSITION"].get<int>());
+			if (!positions.data || positions.count == 0 || positions.componentType != GLTF_FLOAT)
+				continue;
+			const GLBAccessor indices = primitive.contains("indices")
+				? ReadGLBAccessor(gltf, bin, primitive["indices"].get<int>()) : GLBAccessor{};
+			if (primitive.contains("indices") && !indices.data)
+				continue;
+
+			const auto baseVertex = static_cast<uint32_t>(geometry->positionData.size() / 3);
+			const int firstTriangle = static_cast<int>(geometry->indexData.size() / 3);
+			AppendGLBFloats(positions, 3, geometry->positionData);
+
+			if (indices.data) {
+				const size_t start = geometry->indexData.size();
+				geometry->indexData.resize(start + indices.count / 3 * 3);
+				for (size_t i = 0; i < indices.count / 3 * 3; ++i) {
+					const std::byte *index = indices.data + i * indices.stride;
+					uint32_t value = 0;
+					if (indices.componentType == GLTF_UNSIGNED_INT) std::memcpy(&value, index, 4);
+					else if (indices.componentType == GLTF_UNSIGNED_SHORT) { uint16_t v; std::memcpy(&v, index, 2); value = v; }
+					else value = static_cast<uint8_t>(*index);
+					geometry->indexData[start + i] = baseVertex + std::min(value, static_cast<uint32_t>(positions.count - 1));
+				}
+			}
+			else {
+				for (uint32_t i = 0; i < positions.count / 3 * 3; ++i)
+					geometry->indexData.push_back(baseVertex + i);
+			}
+
+			const GLBAccessor normals = attributes.contains("NORMAL")
+				? ReadGLBAccessor(gltf, bin, attributes["NORMAL"].get<int>()) : GLBAccessor{};
+			if (normals.data && normals.count == positions.count && normals.componentType == GLTF_FLOAT)
+				AppendGLBFloats(normals, 3, geometry->normalData);
+			else {
+				// no normals, derive them from the faces
+				geometry->ComputeNormals(baseVertex, firstTriangle);
+			}
+
+			const GLBAccessor texcoords = attributes.contains("TEXCOORD_0")
+				? ReadGLBAccessor(gltf, bin, attributes["TEXCOORD_0"].get<int>()) : GLBAccessor{};
+			const size_t texcoordStart = geometry->texcoordData.size();
+			if (texcoords.data && texcoords.count == positions.count && texcoords.componentType == GLTF_FLOAT) {
+				AppendGLBFloats(texcoords, 2, geometry->texcoordData);
+				// glTF puts v = 0 at the top of the image, our textures start at the bottom row
+				for (size_t i = texcoordStart + 1; i < geometry->texcoordData.size(); i += 2)
+					geometry->texcoordData[i] = 1.0f - geometry->texcoordData[i];
+			}
+			else
+				geometry->texcoordData.resize(texcoordStart + 2 * positions.count);
+
+			int materialIndex;
+			if (primitive.contains("material"))
+				materialIndex = firstMaterial + primitive["material"].get<int>();
+			else {
+				if (defaultMaterial < 0) {
+					defaultMaterial = static_cast<int>(materials->size());
+					materials->push_back(std::make_shared<Material>(Material{
+						glm::vec3(1.0f), glm::vec3(0.0f), 0.0f, 1.0f, 0.0f, 0.0f, "Default", defaultMaterial}));
+				}
+				materialIndex = defaultMaterial;
+			}
+			it->second.push_back({firstTriangle, static_cast<int>(geometry->indexData.size() / 3) - firstTriangle, materialIndex});
+		}
+		return it->second;
+	};
+
+	// Walk the node hierarchy of the default scene
+	std::vector<std::shared_ptr<Mesh>> objects{};
+	std::vector<std::pair<int, glm::mat4>> stack;
+	const auto &nodes = gltf.value("nodes", nlohmann::json::array());
+	if (gltf.contains("scenes")) {
+		for (const auto &node : gltf["scenes"][gltf.value("scene", 0)].value("nodes", std::vector<int>{}))
+			stack.emplace_back(node, glm::mat4(1.0f));
+	}
+	else {
+		std::vector<bool> isChild(nodes.size(), false);
+		for (const auto &node : nodes)
+			for (const int child : node.value("children", std::vector<int>{}))
+				isChild[child] = true;
+		for (int i = 0; i < static_cast<int>(nodes.size()); ++i)
+			if (!isChild[i]) stack.emplace_back(i, glm::mat4(1.0f));
+	}
+
+	while (!stack.empty()) {
+		const auto [nodeIndex, parentTransform] = stack.back();
+		stack.pop_back();
+		const auto &node = nodes[nodeIndex];
+		const glm::mat4 transform = parentTransform * GetGLBNodeTransform(node);
+
+		if (node.contains("mesh")) {
+			const int meshIndex = node["mesh"].get<int>();
+			const std::string name = node.value("name", gltf["meshes"][meshIndex].value("name", "node " + std::to_string(nodeIndex)));
+			const auto &primitives = loadPrimitives(meshIndex);
+			for (size_t i = 0; i < primitives.size(); ++i) {
+				auto mesh = std::make_shared<Mesh>(
+					primitives[i].firstTriangleIndex,
+					primitives[i].nTriangle,
+					primitives[i].materialIndex,
+					true,
+					primitives.size() > 1 ? name + " " + std::to_string(i) : name);
+				mesh->transform = transform;
+				objects.push_back(mesh);
+			}
+		}
+		for (const int child : node.value("children", std::vector<int>{}))
+			stack.emplace_back(child, transform);
+	}
+	return objects;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "BVH.h"
+
+// Triangle geometry in the layout the shader reads it: tightly packed xyz floats (and uv floats) per vertex, three
+// vertex indices per triangle and the BVH nodes of every mesh. The spans either view the owned vectors or the
+// mapped scene cache, so uploads never need to know where the data came from.
+struct Geometry {
+	std::vector<float> positionData, normalData, texcoordData;
+	std::vector<uint32_t> indexData;
+	std::vector<BVHNode> nodeData;
+
+	std::span<const float> positions, normals, texcoords;
+	std::span<const uint32_t> indices;
+	std::span<const BVHNode> nodes;
+
+	void ViewOwnedData() {
+		positions = positionData;
+		normals = normalData;
+		texcoords = texcoordData;
+		indices = indexData;
+		nodes = nodeData;
+	}
+
+	// Copies whatever the spans view elsewhere, e.g. the mapped scene cache, into the owned vectors so it can be edited
+	void TakeOwnership() {
+		if (positions.data() != positionData.data()) positionData.assign(positions.begin(), positions.end());
+		if (normals.data() != normalData.data()) normalData.assign(normals.begin(), normals.end());
+		if (texcoords.data() != texcoordData.data()) texcoordData.assign(texcoords.begin(), texcoords.end());
+		if (indices.data() != indexData.data()) indexData.assign(indices.begin(), indices.end());
+		if (nodes.data() != nodeData.data()) nodeData.assign(nodes.begin(), nodes.end());
+		ViewOwnedData();
+	}
+
+	// Area weighted normals for the owned vertices from firstVertex on, using the triangles from firstTriangle on
+	void ComputeNormals(uint32_t firstVertex, size_t firstTriangle) {
+		normalData.resize(positionData.size());
+		std::fill(normalData.begin() + 3 * static_cast<size_t>(firstVertex), normalData.end(), 0.0f);
+		for (size_t i = 3 * firstTriangle; i < indexData.size(); i += 3) {
+			const uint32_t *triangle = &indexData[i];
+			const glm::vec3 a = glm::make_vec3(&positionData[3 * static_cast<size_t>(triangle[0])]);
+			const glm::vec3 b = glm::make_vec3(&positionData[3 * static_cast<size_t>(triangle[1])]);
+			const glm::vec3 c = glm::make_vec3(&positionData[3 * static_cast<size_t>(triangle[2])]);
+			const glm::vec3 normal = cross(b - a, c - a);
+			for (int j = 0; j < 3; ++j)
+				for (int k = 0; k < 3; ++k)
+					normalData[3 * static_cast<size_t>(triangle[j]) + k] += normal[k];
+		}
+		for (size_t i = 3 * static_cast<size_t>(firstVertex); i < normalData.size(); i += 3) {
+			glm::vec3 normal = glm::make_vec3(&normalData[i]);
+			normal = length(normal) > 0.0f ? normalize(normal) : glm::vec3(0, 1, 0);
+			std::copy_n(&normal[0], 3, &normalData[i]);
+		}
+	}
+
+	[[nodiscard]] uint32_t VertexCount() const {
+		return static_cast<uint32_t>(positions.size() / 3);
+	}
+
+	[[nodiscard]] glm::vec3 Position(uint32_t vertex) const {
+		return {positions[3 * vertex], positions[3 * vertex + 1], positions[3 * vertex + 2]};
+	}
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+// 64-bit content hash used to key the on-disk caches. Not cryptographic, it only needs to notice edits.
+class Hasher {
+public:
+	void Update(const void *data, size_t size) {
+		const auto *bytes = static_cast<const unsigned char*>(data);
+		length += size;
+		for (; size >= 8; bytes += 8, size -= 8) {
+			uint64_t word;
+			std::memcpy(&word, bytes, 8);
+			Mix(word);
+		}
+		if (size > 0) {
+			uint64_t word = 0;
+			std::memcpy(&word, bytes, size);
+			Mix(word);
+		}
+	}
+
+	void Update(std::string_view string) {
+		Update(string.data(), string.size());
+	}
+
+	// Hashes the file contents, returns false if the file could not be read
+	bool UpdateFile(const char *filePath) {
+		std::ifstream file(filePath, std::ios::binary);
+		if (!file.is_open())
+			return false;
+		std::vector<char> buffer(1 << 20);
+		while (file) {
+			file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			Update(buffer.data(), static_cast<size_t>(file.gcount()));
+		}
+		return true;
+	}
+
+	[[nodiscard]] uint64_t Digest() const {
+		uint64_t hash = state ^ length;
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+private:
+	void Mix(uint64_t word) {
+		word *= 0x87c37b91114253d5ull;
+		word = (word << 31) | (word >> 33);
+		state = ((state ^ word) * 0x100000001b3ull) + 0x52dce729ull;
+	}
+
+	uint64_t state = 0xcbf29ce484222325ull;
+	uint64_t length = 0;
+};
@@ -0,0 +1,301 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <glm/ext/matrix_float4x4.hpp>
+
+#include "BVH.h"
+#include "Cluster.h"
+#include "Geometry.h"
+#include "Mesh.h"
+#include "ShaderStructs.h"
+
+// Matches the light types in scene.glsl
+enum EmissiveLightType : int32_t {
+	TRIANGLE_LIGHT,
+	// posA is the center and posB.x the radius
+	SPHERE_LIGHT
+};
+
+// An emissive triangle or sphere in world space. Matches EmissiveLight in scene.glsl (48 bytes).
+struct EmissiveLight {
+	glm::vec3 posA;
+	int32_t materialIndex;
+	glm::vec3 posB;
+	float area;
+	glm::vec3 posC;
+	int32_t type;
+};
+static_assert(sizeof(EmissiveLight) == 48);
+
+// Matches LightNode in scene.glsl (64 bytes). Leaves hold a single light, the children of interior nodes are
+// next to each other like in BVHNode.
+struct LightNode {
+	glm::vec3 boundsMin;
+	int32_t leftFirst; // the light for leaves, the left child otherwise
+	glm::vec3 boundsMax;
+	int32_t lightCount; // 1 for leaves, 0 otherwise
+	// every emitting normal below is within acos(cosTheta) of axis, all of them emit over their hemisphere
+	glm::vec3 axis;
+	float cosTheta;
+	float power;
+	float power_pad[3];
+};
+static_assert(sizeof(LightNode) == 64);
+
+// The light tree is walked with a fixed size stack when finding the probability of a light, so its depth is bounded
+constexpr int LIGHT_TREE_MAX_DEPTH = 31;
+
+// Every surface that emits light, with a tree over them the shader walks to pick a light by its estimated
+// contribution at the point being shaded
+struct LightList {
+	std::vector<EmissiveLight> lights;
+	std::vector<LightNode> nodes;
+	// sum of area times luminance
+	float power = 0.0f;
+};
+
+// The part of the sphere of directions a group of lights emits towards, the cone around every normal of it
+struct DirectionCone {
+	glm::vec3 axis{0.0f};
+	float cosTheta = 1.0f;
+	bool empty = true;
+};
+
+// Smallest cone holding both, from PBRT's light BVH
+static DirectionCone Union(const DirectionCone &a, const DirectionCone &b) {
+	if (a.empty) return b;
+	if (b.empty) return a;
+	const float thetaA = std::acos(std::clamp(a.cosTheta, -1.0f, 1.0f));
+	const float thetaB = std::acos(std::clamp(b.cosTheta, -1.0f, 1.0f));
+	const float thetaD = std::acos(std::clamp(dot(a.axis, b.axis), -1.0f, 1.0f));
+	constexpr float pi = 3.14159265f;
+	if (std::min(thetaD + thetaB, pi) <= thetaA) return a;
+	if (std::min(thetaD + thetaA, pi) <= thetaB) return b;
+
+	const float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+	const glm::vec3 rotationAxis = cross(a.axis, b.axis);
+	if (thetaO >= pi || dot(rotationAxis, rotationAxis) == 0.0f) return {a.axis, -1.0f, false};
+	// rotate a's axis towards b's by the angle the cone grows on a's side (Rodrigues)
+	const float thetaR = thetaO - thetaA;
+	const glm::vec3 k = normalize(rotationAxis);
+	const glm::vec3 axis = a.axis * std::cos(thetaR) + cross(k, a.axis) * std::sin(thetaR) + k * dot(k, a.axis) * (1.0f - std::cos(thetaR));
+	return {normalize(axis), std::cos(thetaO), false};
+}
+
+// Surface area orientation heuristic cost of a node, PBRT's measure of the directions a cone emits towards for
+// lights emitting over their hemisphere
+static float LightNodeCost(const Bounds &bounds, const DirectionCone &cone, float power) {
+	constexpr float pi = 3.14159265f;
+	const float thetaO = std::acos(std::clamp(cone.cosTheta, -1.0f, 1.0f));
+	const float thetaW = std::min(thetaO + pi * 0.5f, pi);
+	const float sinThetaO = std::sin(thetaO);
+	const float orientation = 2.0f * pi * (1.0f - cone.cosTheta) +
+		pi * 0.5f * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + cone.cosTheta);
+	return power * orientation * bounds.Area();
+}
+
+// What the light tree is built from, per light
+struct LightBounds {
+	Bounds bounds;
+	DirectionCone cone;
+	float power;
+	glm::vec3 centroid;
+};
+
+// Builds a binned SAOH tree down to a single light per leaf, the lights keep their order
+static std::vector<LightNode> BuildLightTree(std::span<const LightBounds> lights) {
+	struct BuildEntry {
+		int node, first, count, depth;
+	};
+	struct Bin {
+		Bounds bounds;
+		DirectionCone cone;
+		float power = 0.0f;
+
+		void Grow(const Bounds &otherBounds, const DirectionCone &otherCone, float otherPower) {
+			bounds.Grow(otherBounds);
+			cone = Union(cone, otherCone);
+			power += otherPower;
+		}
+	};
+
+	std::vector<LightNode> nodes;
+	if (lights.empty()) return nodes;
+	std::vector<int> order(lights.size());
+	std::iota(order.begin(), order.end(), 0);
+	nodes.push_back({});
+	std::vector<BuildEntry> stack{{0, 0, static_cast<int>(lights.size()), 0}};
+
+	while (!stack.empty()) {
+		const BuildEntry entry = stack.back();
+		stack.pop_back();
+
+		Bin node;
+		Bounds centroidBounds;
+		for (int i = entry.first; i < entry.first + entry.count; ++i) {
+			const LightBounds &light = lights[order[i]];
+			node.Grow(light.bounds, light.cone, light.power);
+			centroidBounds.Grow(light.centroid);
+		}
+		nodes[entry.node] = {node.bounds.min, order[entry.first], node.bounds.max, 1, node.cone.axis, node.cone.cosTheta, node.power, {}};
+		if (entry.count == 1)
+			continue;
+
+		// the deepest leaf has to stay within the stack the shader walks the tree with, close to it only
+		// balanced splits are left
+		const bool balanced = entry.depth + std::bit_width(static_cast<unsigned>(entry.count - 1)) >= LIGHT_TREE_MAX_DEPTH;
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1, bestBin = 0;
+		const glm::vec3 extent = node.bounds.max - node.bounds.min;
+		const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+		for (int axis = 0; axis < 3 && !balanced; ++axis) {
+			const float centroidExtent = centroidBounds.max[axis] - centroidBounds.min[axis];
+			if (centroidExtent <= 0.0f)
+				continue;
+
+			std::array<Bin, BVH_BIN_COUNT> bins{};
+			const float scale = BVH_BIN_COUNT / centroidExtent;
+			for (int i = entry.first; i < entry.first + entry.count; ++i) {
+				const LightBounds &light = lights[order[i]];
+				const int bin = std::min(BVH_BIN_COUNT - 1, static_cast<int>((light.centroid[axis] - centroidBounds.min[axis]) * scale));
+				bins[bin].Grow(light.bounds, light.cone, light.power);
+			}
+
+			// splitting across a thin node's short side is penalised
+			const float kr = longest / std::max(extent[axis], longest * 1e-3f);
+			std::array<float, BVH_BIN_COUNT - 1> leftCost{};
+			Bin left;
+			for (int i = 0; i < BVH_BIN_COUNT - 1; ++i) {
+				left.Grow(bins[i].bounds, bins[i].cone, bins[i].power);
+				leftCost[i] = left.power > 0.0f ? LightNodeCost(left.bounds, left.cone, left.power) : 0.0f;
+			}
+			Bin right;
+			for (int i = BVH_BIN_COUNT - 1; i > 0; --i) {
+				right.Grow(bins[i].bounds, bins[i].cone, bins[i].power);
+				if (left.power <= 0.0f) continue;
+				const float cost = kr * (leftCost[i - 1] + (right.power > 0.0f ? LightNodeCost(right.bounds, right.cone, right.power) : 0.0f));
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		int split = entry.first;
+		if (bestAxis >= 0) {
+			const float scale = BVH_BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+			const auto middle = std::partition(order.begin() + entry.first, order.begin() + entry.first + entry.count,
+				[&](int i) {
+					const int bin = std::min(BVH_BIN_COUNT - 1,
+						static_cast<int>((lights[i].centroid[bestAxis] - centroidBounds.min[bestAxis]) * scale));
+					return bin < bestBin;
+				});
+			split = static_cast<int>(middle - order.begin());
+		}
+		if (split == entry.first || split == entry.first + entry.count) {
+			// halve along the widest spread of centroids
+			const glm::vec3 spread = centroidBounds.max - centroidBounds.min;
+			const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : spread.y >= spread.z ? 1 : 2;
+			split = entry.first + entry.count / 2;
+			std::nth_element(order.begin() + entry.first, order.begin() + split, order.begin() + entry.first + entry.count,
+				[&](int a, int b) { return lights[a].centroid[axis] < lights[b].centroid[axis]; });
+		}
+
+		const int leftNode = static_cast<int>(nodes.size());
+		nodes.push_back({});
+		nodes.push_back({});
+		nodes[entry.node].leftFirst = leftNode;
+		nodes[entry.node].lightCount = 0;
+		stack.push_back({leftNode, entry.first, split - entry.first, entry.depth + 1});
+		stack.push_back({leftNode + 1, split, entry.first + entry.count - split, entry.depth + 1});
+	}
+	return nodes;
+}
+
+static float Luminance(const glm::vec3 &color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+// Calls triangle(a, b, c) with the object space corners of every triangle of a mesh BVH. Clustered geometry keeps
+// each cluster's triangles and vertices on their own, the mesh's triangle range only applies before clustering.
+template<typename Function>
+static void ForEachMeshTriangle(const Geometry &geometry, std::span<const ClusterRecord> clusters, const Mesh &mesh, Function triangle) {
+	auto corners = [&](size_t firstIndex, uint32_t firstVertex) {
+		triangle(geometry.Position(firstVertex + geometry.indices[firstIndex]),
+			geometry.Position(firstVertex + geometry.indices[firstIndex + 1]),
+			geometry.Position(firstVertex + geometry.indices[firstIndex + 2]));
+	};
+	if (clusters.empty()) {
+		for (int i = mesh.firstTriangleIndex; i < mesh.firstTriangleIndex + mesh.nTriangle; ++i)
+			corners(3 * static_cast<size_t>(i), 0);
+		return;
+	}
+	std::vector<int> stack{mesh.rootNodeIndex};
+	while (!stack.empty()) {
+		const BVHNode &node = geometry.nodes[stack.back()];
+		stack.pop_back();
+		if (node.triangleCount == CLUSTER_NODE) {
+			const ClusterRecord &cluster = clusters[node.leftFirst];
+			for (uint32_t i = 0; i < cluster.triangleCount; ++i)
+				corners(3 * static_cast<size_t>(cluster.firstTriangle + i), cluster.firstVertex);
+		}
+		else
+			stack.insert(stack.end(), {node.leftFirst, node.leftFirst + 1});
+	}
+}
+
+// Lists the emissive spheres and the triangles of visible emissive meshes and builds the light tree over them.
+// Meshes whose triangles aren't on the CPU yet, while the scene is still streaming in, are left out until it is.
+static LightList BuildLightList(const std::vector<std::shared_ptr<Sphere>> &spheres, const std::vector<std::shared_ptr<Mesh>> &meshes,
+	const std::vector<std::shared_ptr<Material>> &materials, const Geometry &geometry, std::span<const ClusterRecord> clusters)
+{
+	auto radiance = [&](int materialIndex) {
+		if (materialIndex < 0 || materialIndex >= static_cast<int>(materials.size())) return 0.0f;
+		return Luminance(materials[materialIndex]->emissionColor * materials[materialIndex]->strength);
+	};
+
+	LightList list;
+	std::vector<LightBounds> bounds;
+	for (const auto &sphere : spheres) {
+		const float luminance = radiance(sphere->materialIndex);
+		if (luminance <= 0.0f) continue;
+		const float area = 4.0f * 3.14159265f * sphere->radius * sphere->radius;
+		list.lights.push_back({sphere->center, sphere->materialIndex, glm::vec3(sphere->radius), area, glm::vec3(0.0f), SPHERE_LIGHT});
+		LightBounds &light = bounds.emplace_back(LightBounds{{}, {glm::vec3(0, 1, 0), -1.0f, false}, area * luminance, sphere->center});
+		light.bounds.Grow(sphere->center - sphere->radius);
+		light.bounds.Grow(sphere->center + sphere->radius);
+	}
+	for (const auto &mesh : meshes) {
+		const float luminance = radiance(mesh->materialIndex);
+		if (!mesh->visible || luminance <= 0.0f) continue;
+		if (clusters.empty() ? 3 * static_cast<size_t>(mesh->firstTriangleIndex + mesh->nTriangle) > geometry.indices.size()
+			: static_cast<size_t>(mesh->rootNodeIndex) >= geometry.nodes.size())
+			continue;
+		ForEachMeshTriangle(geometry, clusters, *mesh, [&](glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+			a = glm::vec3(mesh->transform * glm::vec4(a, 1.0f));
+			b = glm::vec3(mesh->transform * glm::vec4(b, 1.0f));
+			c = glm::vec3(mesh->transform * glm::vec4(c, 1.0f));
+			const float area = 0.5f * length(cross(b - a, c - a));
+			if (area <= 0.0f || !std::isfinite(area)) return;
+			list.lights.push_back({a, mesh->materialIndex, b, area, c, TRIANGLE_LIGHT});
+			LightBounds &light = bounds.emplace_back(LightBounds{{}, {normalize(cross(b - a, c - a)), 1.0f, false}, area * luminance, (a + b + c) / 3.0f});
+			for (const glm::vec3 &corner : {a, b, c}) light.bounds.Grow(corner);
+		});
+	}
+
+	list.nodes = BuildLightTree(bounds);
+	if (!list.nodes.empty()) list.power = list.nodes.front().power;
+	return list;
+}
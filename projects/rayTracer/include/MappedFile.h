@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	explicit MappedFile(const char *filePath) {
+#ifdef _WIN32
+		file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) return;
+		data = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (data) size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		const int file = open(filePath, O_RDONLY);
+		if (file < 0) return;
+		struct stat status{};
+		if (fstat(file, &status) == 0 && status.st_size > 0) {
+			void *address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (address != MAP_FAILED) {
+				data = static_cast<const std::byte*>(address);
+				size = static_cast<size_t>(status.st_size);
+			}
+		}
+		// the mapping keeps the file referenced
+		close(file);
+#endif
+	}
+
+	~MappedFile() {
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile &&other) noexcept {
+		if (this != &other) {
+			Close();
+			data = std::exchange(other.data, nullptr);
+			size = std::exchange(other.size, 0);
+#ifdef _WIN32
+			file = std::exchange(other.file, INVALID_HANDLE_VALUE);
+			mapping = std::exchange(other.mapping, nullptr);
+#endif
+		}
+		return *this;
+	}
+
+	[[nodiscard]] bool IsOpen() const { return data != nullptr; }
+	[[nodiscard]] const std::byte* Data() const { return data; }
+	[[nodiscard]] size_t Size() const { return size; }
+
+	void Close() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data) munmap(const_cast<std::byte*>(data), size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+private:
+	const std::byte *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ShaderStruct.h"
+#include "ShaderStructs.h"
+
+// Material features the path tracing programs are specialized for. A program built for a set of them compiles
+// the branches of the others out, so scenes with simple materials run a leaner kernel. Must match scene.glsl.
+constexpr unsigned METALLIC_MATERIALS = 1;
+constexpr unsigned TRANSPARENT_MATERIALS = 2;
+constexpr unsigned TEXTURED_MATERIALS = 4;
+constexpr unsigned ALL_MATERIAL_FEATURES = METALLIC_MATERIALS | TRANSPARENT_MATERIALS | TEXTURED_MATERIALS;
+
+// The features at least one of the materials uses
+static unsigned MaterialFeatures(const std::vector<std::shared_ptr<Material>> &materials) {
+	unsigned features = 0;
+	for (const auto &material : materials) {
+		// the metallic texture only scales the material's metallic
+		if (material->metallic > 0.0f) features |= METALLIC_MATERIALS;
+		if (material->ior != 0.0f) features |= TRANSPARENT_MATERIALS;
+		if (material->albedoTexture >= 0 || material->roughnessTexture >= 0 || material->metallicTexture >= 0)
+			features |= TEXTURED_MATERIALS;
+	}
+	return features;
+}
+
+// Defines selecting the features, they go right after the #version line
+static std::string MaterialFeatureDefines(unsigned features) {
+	std::string defines;
+	for (const auto &[feature, name] : {std::pair{METALLIC_MATERIALS, "METALLIC_MATERIALS"},
+		std::pair{TRANSPARENT_MATERIALS, "TRANSPARENT_MATERIALS"}, std::pair{TEXTURED_MATERIALS, "TEXTURED_MATERIALS"}})
+		defines += std::string("#define ") + name + (features & feature ? " 1\n" : " 0\n");
+	return defines;
+}
+
+// Every permutation keeps its own program binary, so switching scenes back and forth doesn't relink,
+// e.g. resources/cache/tiled.rtprogram becomes resources/cache/tiled.5.rtprogram
+static std::string PermutationCachePath(const std::string &cachePath, unsigned features) {
+	std::filesystem::path path(cachePath);
+	path.replace_filename(path.stem().string() + "." + std::to_string(features) + path.extension().string());
+	return path.string();
+}
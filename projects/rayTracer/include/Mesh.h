@@ -1,15 +1,34 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <iostream>
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/ext/matrix_float4x4.hpp>
+#include <glm/matrix.hpp>
 
+#include "Geometry.h"
 #include "ShaderStruct.h"
 #include "ShaderStructs.h"
 
 
+// Levels of detail per mesh, including the full resolution one. Matches the vec4s in MeshInfo.
+constexpr int MESH_LOD_COUNT = 4;
+
+// A simplified copy of a mesh's triangles with its own BVH
+struct MeshLOD {
+	int32_t firstTriangleIndex, nTriangle, rootNodeIndex;
+	// object space distance to the full resolution surface
+	float error;
+};
+
 struct Mesh final : ShaderStruct{
 	Mesh(int firstTriangleIndex, int nTriangle, int materialIndex, bool visible, std::string name):
 	firstTriangleIndex(firstTriangleIndex), nTriangle(nTriangle), materialIndex(materialIndex), visible(visible), name(name){};
@@ -17,19 +36,81 @@ struct Mesh final : ShaderStruct{
 	int firstTriangleIndex, nTriangle, materialIndex;
 	bool visible;
 	std::string name;
+	int rootNodeIndex = 0;
+	// Object to world, meshes sharing a triangle range are instances of the same geometry
+	glm::mat4 transform{1.0f};
+	// coarser levels, each with about half the triangles of the one before
+	std::vector<MeshLOD> lods;
 	[[nodiscard]] std::vector<std::byte> GetBytes() override {
-		return ConvertToBytes(firstTriangleIndex, nTriangle, materialIndex, visible);
+		glm::ivec4 lodRootNodeIndex(rootNodeIndex);
+		glm::vec4 lodError(0.0f);
+		for (size_t i = 0; i < lods.size(); ++i) {
+			lodRootNodeIndex[i + 1] = lods[i].rootNodeIndex;
+			lodError[i + 1] = lods[i].error;
+		}
+		return ConvertToBytes(inverse(transform), firstTriangleIndex, nTriangle, materialIndex, visible,
+			lodRootNodeIndex, lodError, static_cast<int>(lods.size()) + 1);
 	}
 };
 
-static std::vector<std::shared_ptr<Mesh>> loadMesh(const char* filePath, std::vector<std::shared_ptr<Triangle>> *triangles) {
+// Builds one BVH per distinct triangle range, including every LOD, instances of the same geometry share it
+static void BuildMeshBVHs(Geometry &geometry, const std::vector<std::shared_ptr<Mesh>> &meshes) {
+	std::map<std::pair<int, int>, int> roots;
+	auto build = [&](int firstTriangleIndex, int nTriangle) {
+		const auto [it, inserted] = roots.try_emplace({firstTriangleIndex, nTriangle}, 0);
+		if (inserted)
+			it->second = BuildBVH(geometry.positionData, geometry.indexData, firstTriangleIndex, nTriangle, geometry.nodeData);
+		return it->second;
+	};
+	for (const auto &mesh : meshes) {
+		mesh->rootNodeIndex = build(mesh->firstTriangleIndex, mesh->nTriangle);
+		for (MeshLOD &lod : mesh->lods)
+			lod.rootNodeIndex = build(lod.firstTriangleIndex, lod.nTriangle);
+	}
+}
+
+// (position, texture coordinate, normal) OBJ index triple
+struct OBJVertexKey {
+	int position, texcoord, normal;
+	bool operator==(const OBJVertexKey &) const = default;
+};
+
+struct OBJVertexKeyHash {
+	size_t operator()(const OBJVertexKey &key) const {
+		const uint64_t h = (static_cast<uint64_t>(key.position) << 32 | static_cast<uint32_t>(key.normal)) * 0x9E3779B97F4A7C15ull;
+		return static_cast<size_t>(h ^ static_cast<uint32_t>(key.texcoord) * 0xC2B2AE3Du);
+	}
+};
+
+// Appends the OBJ's triangles to the geometry, sharing a vertex between faces that use the same position, texture
+// coordinate and normal
+// OBJ files don't carry materials here, an object's usemtl names one of namedMaterials instead
+static std::vector<std::shared_ptr<Mesh>> loadMesh(const char* filePath, Geometry *geometry,
+	const std::vector<std::shared_ptr<Material>> *namedMaterials = nullptr) {
 	// Open the OBJ file
 	std::ifstream file(filePath);
 	assert(file.is_open());
 
-	// Temporary storage for vertices and normals
+	// Temporary storage for vertices, texture coordinates and normals
 	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> texcoords;
 	std::vector<glm::vec3> normals;
+	// index triple -> geometry vertex
+	std::unordered_map<OBJVertexKey, uint32_t, OBJVertexKeyHash> vertexLookup;
+
+	auto getVertex = [&](int position, int texcoord, int normal) {
+		const auto [it, inserted] = vertexLookup.try_emplace({position, texcoord, normal}, static_cast<uint32_t>(geometry->positionData.size() / 3));
+		if (inserted) {
+			// OBJ files are 1-indexed, so decrement indices. Texture coordinate 0 means the face has none.
+			const glm::vec3 &p = vertices[position - 1];
+			const glm::vec2 t = texcoord > 0 ? texcoords[texcoord - 1] : glm::vec2(0.0f);
+			const glm::vec3 &n = normals[normal - 1];
+			geometry->positionData.insert(geometry->positionData.end(), {p.x, p.y, p.z});
+			geometry->texcoordData.insert(geometry->texcoordData.end(), {t.x, t.y});
+			geometry->normalData.insert(geometry->normalData.end(), {n.x, n.y, n.z});
+		}
+		return it->second;
+	};
 
 	// Temporary variables to compute bounds
 	std::vector<std::shared_ptr<Mesh>> objects{};
@@ -40,12 +121,18 @@ static std::vector<std::shared_ptr<Mesh>> loadMesh(const char* filePath, std::ve
 		if (line.substr(0, 2) == "o ") {
 			objects.push_back(
 				std::make_shared<Mesh>(
-					static_cast<int>(triangles->size()),
+					static_cast<int>(geometry->indexData.size() / 3),
 					0, 0,
 					true,
 					line.substr(2, line.size()))
 			);
 		}
+		else if (line.substr(0, 7) == "usemtl " && namedMaterials && !objects.empty()) {
+			const std::string name = line.substr(7);
+			const auto material = std::ranges::find(*namedMaterials, name, [](const auto &m) { return m->name; });
+			if (material != namedMaterials->end()) objects.back()->materialIndex = (*material)->index;
+			else std::cout << filePath << ": no material named " << name << std::endl;
+		}
 		// Parse vertex data
 		else if (line.substr(0, 2) == "v ") {
 			std::istringstream iss(line.substr(2));
@@ -53,6 +140,12 @@ static std::vector<std::shared_ptr<Mesh>> loadMesh(const char* filePath, std::ve
 			iss >> x >> y >> z;
 			vertices.emplace_back(x, y, z);
 		}
+		else if (line.substr(0, 3) == "vt ") {
+			std::istringstream iss(line.substr(3));
+			float u, v;
+			iss >> u >> v;
+			texcoords.emplace_back(u, v);
+		}
 		else if (line.substr(0, 3) == "vn ") {
 			std::istringstream iss(line.substr(3));
 			float x, y, z;
@@ -69,15 +162,12 @@ static std::vector<std::shared_ptr<Mesh>> loadMesh(const char* filePath, std::ve
 				>> idx2 >> slash >> tex2 >> slash >> normal2
 				>> idx3 >> slash >> tex3 >> slash >> normal3;
 
-			// Add triangle to mesh, OBJ files are 1-indexed, so decrement indices
-			triangles->push_back(std::make_shared<Triangle>(
-				vertices[idx1 - 1],
-				vertices[idx2 - 1],
-				vertices[idx3 - 1],
-				normals[normal1 - 1],
-				normals[normal2 - 1],
-				normals[normal3 - 1]
-			));
+			// Add triangle to mesh
+			geometry->indexData.insert(geometry->indexData.end(), {
+				getVertex(idx1, tex1, normal1),
+				getVertex(idx2, tex2, normal2),
+				getVertex(idx3, tex3, normal3)
+			});
 			objects[objects.size()-1]->nTriangle++;
 		}
 	}
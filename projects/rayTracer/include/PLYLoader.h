@@ -0,0 +1,277 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Geometry.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+
+enum class PLYType : uint8_t { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID };
+
+static PLYType ParsePLYType(const std::string &name) {
+	if (name == "char" || name == "int8") return PLYType::INT8;
+	if (name == "uchar" || name == "uint8") return PLYType::UINT8;
+	if (name == "short" || name == "int16") return PLYType::INT16;
+	if (name == "ushort" || name == "uint16") return PLYType::UINT16;
+	if (name == "int" || name == "int32") return PLYType::INT32;
+	if (name == "uint" || name == "uint32") return PLYType::UINT32;
+	if (name == "float" || name == "float32") return PLYType::FLOAT32;
+	if (name == "double" || name == "float64") return PLYType::FLOAT64;
+	return PLYType::INVALID;
+}
+
+static size_t PLYTypeSize(PLYType type) {
+	constexpr size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+	return sizes[static_cast<int>(type)];
+}
+
+template<typename T>
+static T ReadPLYScalar(const std::byte *data, bool swapBytes) {
+	T value;
+	if (!swapBytes) {
+		std::memcpy(&value, data, sizeof(T));
+		return value;
+	}
+	std::byte swapped[sizeof(T)];
+	for (size_t i = 0; i < sizeof(T); ++i)
+		swapped[i] = data[sizeof(T) - 1 - i];
+	std::memcpy(&value, swapped, sizeof(T));
+	return value;
+}
+
+template<typename T>
+static T ReadPLYValue(const std::byte *data, PLYType type, bool swapBytes) {
+	switch (type) {
+		case PLYType::INT8: return static_cast<T>(ReadPLYScalar<int8_t>(data, swapBytes));
+		case PLYType::UINT8: return static_cast<T>(ReadPLYScalar<uint8_t>(data, swapBytes));
+		case PLYType::INT16: return static_cast<T>(ReadPLYScalar<int16_t>(data, swapBytes));
+		case PLYType::UINT16: return static_cast<T>(ReadPLYScalar<uint16_t>(data, swapBytes));
+		case PLYType::INT32: return static_cast<T>(ReadPLYScalar<int32_t>(data, swapBytes));
+		case PLYType::UINT32: return static_cast<T>(ReadPLYScalar<uint32_t>(data, swapBytes));
+		case PLYType::FLOAT32: return static_cast<T>(ReadPLYScalar<float>(data, swapBytes));
+		case PLYType::FLOAT64: return static_cast<T>(ReadPLYScalar<double>(data, swapBytes));
+		default: return T{};
+	}
+}
+
+struct PLYProperty {
+	std::string name;
+	PLYType type = PLYType::INVALID;
+	// list properties store their element count first
+	PLYType countType = PLYType::INVALID;
+};
+
+struct PLYElement {
+	std::string name;
+	size_t count = 0;
+	std::vector<PLYProperty> properties;
+
+	// Byte size of one element, 0 if it contains lists
+	[[nodiscard]] size_t FixedSize() const {
+		size_t size = 0;
+		for (const auto &property : properties) {
+			if (property.countType != PLYType::INVALID) return 0;
+			size += PLYTypeSize(property.type);
+		}
+		return size;
+	}
+};
+
+// Appends a binary (little or big endian) PLY mesh to the geometry as a single Mesh. The mapped file is read
+// element by element straight into the geometry streams, polygons are fan triangulated and normals are derived
+// from the faces when the file has none. Texture coordinates are zero when the file has none.
+static std::vector<std::shared_ptr<Mesh>> loadPLY(const char* filePath, Geometry *geometry) {
+	const MappedFile file(filePath);
+	assert(file.IsOpen());
+	const std::byte *data = file.Data();
+	const std::byte *end = file.Data() + file.Size();
+
+	// Parse the ASCII header
+	const std::string_view text(reinterpret_cast<const char*>(data), std::min<size_t>(file.Size(), 1 << 16));
+	const size_t headerEnd = text.find("end_header");
+	if (!text.starts_with("ply") || headerEnd == std::string_view::npos) return {};
+	std::istringstream header{std::string(text.substr(0, headerEnd))};
+	data += text.find('\n', headerEnd) + 1;
+
+	bool swapBytes = false;
+	std::vector<PLYElement> elements;
+	std::string line;
+	while (std::getline(header, line)) {
+		std::istringstream iss(line);
+		std::string keyword;
+		iss >> keyword;
+		if (keyword == "format") {
+			std::string format;
+			iss >> format;
+			if (format == "ascii") return {};
+			swapBytes = (format == "binary_big_endian") != (std::endian::native == std::endian::big);
+		}
+		else if (keyword == "element") {
+			PLYElement element;
+			iss >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty()) {
+			PLYProperty property;
+			std::string type;
+			iss >> type;
+			if (type == "list") {
+				std::string countType;
+				iss >> countType >> type;
+				property.countType = ParsePLYType(countType);
+			}
+			property.type = ParsePLYType(type);
+			iss >> property.name;
+			if (property.type == PLYType::INVALID) return {};
+			elements.back().properties.push_back(property);
+		}
+	}
+
+	const auto baseVertex = static_cast<uint32_t>(geometry->positionData.size() / 3);
+	const size_t firstTriangle = geometry->indexData.size() / 3;
+	bool hasNormals = false;
+
+	// Drop whatever was appended from a truncated or unsupported file
+	auto fail = [&]() -> std::vector<std::shared_ptr<Mesh>> {
+		geometry->positionData.resize(3 * static_cast<size_t>(baseVertex));
+		geometry->normalData.resize(3 * static_cast<size_t>(baseVertex));
+		geometry->texcoordData.resize(2 * static_cast<size_t>(baseVertex));
+		geometry->indexData.resize(3 * firstTriangle);
+		return {};
+	};
+	// Bytes left in the file, every advance is checked against it before data moves
+	auto remaining = [&]() { return static_cast<size_t>(end - data); };
+
+	for (const auto &element : elements) {
+		const size_t fixedSize = element.FixedSize();
+
+		if (element.name == "vertex") {
+			// Offsets of x, y, z, nx, ny, nz, u, v in each vertex record, texture coordinates go by several names
+			constexpr std::string_view names[8][3] = {{"x"}, {"y"}, {"z"}, {"nx"}, {"ny"}, {"nz"},
+				{"u", "s", "texture_u"}, {"v", "t", "texture_v"}};
+			int offsets[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+			PLYType types[8]{};
+			size_t offset = 0;
+			for (const auto &property : element.properties) {
+				for (int i = 0; i < 8; ++i)
+					if (std::ranges::find(names[i], property.name) != std::end(names[i])) {
+						offsets[i] = static_cast<int>(offset);
+						types[i] = property.type;
+					}
+				offset += PLYTypeSize(property.type);
+			}
+			if (fixedSize == 0 || offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0 || element.count > remaining() / fixedSize)
+				return fail();
+			hasNormals = offsets[3] >= 0 && offsets[4] >= 0 && offsets[5] >= 0;
+			const bool hasTexcoords = offsets[6] >= 0 && offsets[7] >= 0;
+
+			const size_t start = geometry->positionData.size();
+			geometry->positionData.resize(start + 3 * element.count);
+			if (hasNormals) geometry->normalData.resize(start + 3 * element.count);
+			geometry->texcoordData.resize(start / 3 * 2 + 2 * element.count);
+			float *positions = geometry->positionData.data() + start;
+			float *normals = hasNormals ? geometry->normalData.data() + start : nullptr;
+			float *texcoords = geometry->texcoordData.data() + start / 3 * 2;
+
+			const bool packedFloats = !swapBytes && offsets[0] == 0 && offsets[1] == 4 && offsets[2] == 8 &&
+				types[0] == PLYType::FLOAT32 && types[1] == PLYType::FLOAT32 && types[2] == PLYType::FLOAT32;
+			if (packedFloats && fixedSize == 12) {
+				// xyz only, the records are already in our layout
+				std::memcpy(positions, data, element.count * fixedSize);
+				data += element.count * fixedSize;
+				continue;
+			}
+			for (size_t i = 0; i < element.count; ++i, data += fixedSize) {
+				for (int j = 0; j < 3; ++j)
+					positions[3 * i + j] = ReadPLYValue<float>(data + offsets[j], types[j], swapBytes);
+				if (hasNormals)
+					for (int j = 0; j < 3; ++j)
+						normals[3 * i + j] = ReadPLYValue<float>(data + offsets[3 + j], types[3 + j], swapBytes);
+				if (hasTexcoords)
+					for (int j = 0; j < 2; ++j)
+						texcoords[2 * i + j] = ReadPLYValue<float>(data + offsets[6 + j], types[6 + j], swapBytes);
+			}
+		}
+		else if (element.name == "face") {
+			// Faces are mostly triangles, reserve for that to avoid regrowing huge index buffers
+			geometry->indexData.reserve(geometry->indexData.size() + 3 * element.count);
+			const auto vertexCount = static_cast<uint32_t>(geometry->positionData.size() / 3) - baseVertex;
+			if (vertexCount == 0) return fail();
+			// grows to the largest polygon, most files never go past a triangle
+			std::vector<uint32_t> polygon;
+
+			for (size_t i = 0; i < element.count; ++i) {
+				for (const auto &property : element.properties) {
+					if (property.countType == PLYType::INVALID) {
+						if (PLYTypeSize(property.type) > remaining()) return fail();
+						data += PLYTypeSize(property.type);
+						continue;
+					}
+					if (PLYTypeSize(property.countType) > remaining()) return fail();
+					const auto count = ReadPLYValue<uint32_t>(data, property.countType, swapBytes);
+					data += PLYTypeSize(property.countType);
+					const size_t listSize = static_cast<size_t>(count) * PLYTypeSize(property.type);
+					if (listSize > remaining()) return fail();
+
+					if ((property.name == "vertex_indices" || property.name == "vertex_index") && count >= 3) {
+						polygon.resize(count);
+						// 32 bit integers are copied as they are, other types are converted
+						if (!swapBytes && (property.type == PLYType::INT32 || property.type == PLYType::UINT32))
+							std::memcpy(polygon.data(), data, count * sizeof(uint32_t));
+						else
+							for (uint32_t j = 0; j < count; ++j)
+								polygon[j] = ReadPLYValue<uint32_t>(data + j * PLYTypeSize(property.type), property.type, swapBytes);
+						for (uint32_t j = 0; j < count; ++j)
+							polygon[j] = baseVertex + std::min(polygon[j], vertexCount - 1);
+						for (uint32_t j = 2; j < count; ++j)
+							geometry->indexData.insert(geometry->indexData.end(), {polygon[0], polygon[j - 1], polygon[j]});
+					}
+					data += listSize;
+				}
+			}
+		}
+		else {
+			// Skip unused elements
+			if (fixedSize > 0) {
+				if (element.count > remaining() / fixedSize) return fail();
+				data += element.count * fixedSize;
+				continue;
+			}
+			for (size_t i = 0; i < element.count; ++i)
+				for (const auto &property : element.properties) {
+					if (property.countType == PLYType::INVALID) {
+						if (PLYTypeSize(property.type) > remaining()) return fail();
+						data += PLYTypeSize(property.type);
+						continue;
+					}
+					if (PLYTypeSize(property.countType) > remaining()) return fail();
+					const auto count = ReadPLYValue<uint32_t>(data, property.countType, swapBytes);
+					data += PLYTypeSize(property.countType);
+					const size_t listSize = static_cast<size_t>(count) * PLYTypeSize(property.type);
+					if (listSize > remaining()) return fail();
+					data += listSize;
+				}
+		}
+	}
+
+	if (!hasNormals)
+		geometry->ComputeNormals(baseVertex, firstTriangle);
+
+	return {
+		std::make_shared<Mesh>(
+			static_cast<int>(firstTriangle),
+			static_cast<int>(geometry->indexData.size() / 3 - firstTriangle),
+			0,
+			true,
+			std::filesystem::path(filePath).stem().string())
+	};
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "glad/glad.h"
+#include "Hash.h"
+
+// Program binary cache (.rtprogram): the driver's glGetProgramBinary output of a linked program, keyed by its
+// sources and the driver that built it so edits and driver updates fall back to compiling from source.
+constexpr char PROGRAM_CACHE_MAGIC[8] = {'R', 'T', 'P', 'R', 'O', 'G', '\0', '\0'};
+
+struct ProgramCacheHeader {
+	char magic[8];
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+};
+
+// Key of a program linked from these stage sources by the current driver
+static uint64_t ProgramCacheKey(const std::vector<std::vector<std::string>> &stages) {
+	Hasher hasher;
+	for (const GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+		const auto *string = reinterpret_cast<const char*>(glGetString(name));
+		hasher.Update(string ? string : "");
+		hasher.Update("\n");
+	}
+	for (const auto &sources : stages) {
+		for (const auto &source : sources)
+			hasher.Update(source);
+		// a stage boundary, so moving a file between stages changes the key
+		hasher.Update("\0stage", 6);
+	}
+	return hasher.Digest();
+}
+
+// Creates a program from its cached binary, 0 if there is none for this key or the driver rejects it
+static GLuint LoadProgramBinary(const char *filePath, uint64_t key) {
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open()) return 0;
+	ProgramCacheHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		std::memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 || header.key != key)
+		return 0;
+	std::vector<char> binary(header.size);
+	if (!file.read(binary.data(), static_cast<std::streamsize>(binary.size()))) return 0;
+
+	const GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+	GLint success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// Stores a linked program's binary, it has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+static bool SaveProgramBinary(const char *filePath, uint64_t key, GLuint program) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return false;
+	ProgramCacheHeader header{};
+	std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+	header.key = key;
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	header.format = format;
+	header.size = static_cast<uint32_t>(length);
+
+	// Write to a temporary file first so a crash never leaves a half written binary behind
+	const std::filesystem::path path(filePath);
+	std::filesystem::path temporaryPath = path;
+	temporaryPath += ".tmp";
+	std::error_code error;
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), error);
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(binary.data(), header.size);
+		if (!file) return false;
+	}
+	std::filesystem::rename(temporaryPath, path, error);
+	return !error;
+}
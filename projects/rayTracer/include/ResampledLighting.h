@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/vec2.hpp>
+
+#include "glad/glad.h"
+#include "ComputeFrame.h"
+#include "ShaderProgram.h"
+#include "SSBO.h"
+#include "TemporalReprojection.h"
+
+// Must match resample.comp and restir.glsl
+constexpr int RESAMPLE_GROUP_SIZE = 8;
+// The kept light's point, normal and radiance, the resampling weight sum, candidate count and contribution weight
+constexpr size_t RESERVOIR_SIZE = 48;
+
+// ReSTIR direct lighting: every pixel's first hit resamples many light candidates down to one, reusing what the
+// frames before and the neighbouring pixels found. The first bounce of the paths takes that light instead of a
+// single sample of its own.
+struct ResamplingSettings {
+	bool enabled = false;
+	int candidates = 32;
+	bool temporalReuse = true;
+	// the frames before count for at most this many times a frame's candidates
+	float temporalLimit = 20.0f;
+	int spatialSamples = 5;
+	float spatialRadius = 30.0f;
+	// shadow test the neighbours' samples before reusing them, without it shadow edges come out biased
+	bool spatialVisibility = true;
+};
+
+// Runs the resampling passes over the first hits TemporalReprojection stores at every restart. After camera moves
+// the reservoirs are carried over through the replaced view's first hits, wherever the same surface is seen. The
+// reservoirs stay in their buffer for the renderers to read.
+class ResampledLighting {
+public:
+	ResampledLighting(std::vector<const char*> paths, glm::ivec2 imageSize) : paths(std::move(paths)), imageSize(imageSize), reservoirBuffer(19)
+	{
+		// one reservoir per pixel after the temporal pass and one after the spatial pass, empty until the first frame
+		const std::vector<std::byte> reservoirs(2 * static_cast<size_t>(imageSize.x) * imageSize.y * RESERVOIR_SIZE);
+		reservoirBuffer.BufferData(reservoirs.data(), reservoirs.size());
+
+		Rebuild();
+		build->Poll(true);
+		const bool built = SwapBuiltPrograms();
+		assert(built);
+	}
+
+	~ResampledLighting() {
+		glDeleteProgram(program);
+	}
+
+	ResampledLighting(const ResampledLighting&) = delete;
+	ResampledLighting& operator=(const ResampledLighting&) = delete;
+
+	// The sources of the program, for watching them
+	[[nodiscard]] const std::vector<const char*>& Paths() const { return paths; }
+
+	// Starts building the program again in the background, the running one keeps resampling until it linked
+	void Rebuild() {
+		build = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_COMPUTE_SHADER, paths, {}}}, "resources/cache/resample.rtprogram");
+	}
+
+	// Swaps the rebuilt program in once it is done, keeping the running one if it failed.
+	// Returns true if the program was swapped.
+	bool SwapBuiltPrograms() {
+		if (!build) return false;
+		const ProgramStatus status = build->Poll();
+		if (status == ProgramStatus::PENDING) return false;
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(program);
+			program = build->Take();
+		}
+		else std::cout << "Failed to build the resampling shader, keeping the previous one:\n" << build->Log() << std::endl;
+		build.reset();
+		return status == ProgramStatus::READY;
+	}
+
+	// Resamples the frame's direct light at the temporal reprojection's first hits. viewChanged tells whether the
+	// accumulation restarted only because the camera moved, the previous view's reservoirs still apply then.
+	void Resample(const ComputeFrame &frame, const TemporalReprojection &temporal, const ResamplingSettings &settings, bool viewChanged) {
+		const bool reuseAcrossViews = viewChanged && temporal.HasReplacedView();
+		SetFrameUniforms(program, frame, imageSize);
+		glProgramUniform1i(program, glGetUniformLocation(program, "ReuseAcrossViews"), reuseAcrossViews);
+		glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "PreviousViewProjection"), 1, false, &temporal.ReplacedViewProjection()[0][0]);
+		glProgramUniform1i(program, glGetUniformLocation(program, "SpatialVisibility"), settings.spatialVisibility);
+		glProgramUniform1ui(program, glGetUniformLocation(program, "ResampleFrame"), resampleFrame++);
+		glProgramUniform1i(program, glGetUniformLocation(program, "CandidateCount"), std::max(settings.candidates, 1));
+		glProgramUniform1i(program, glGetUniformLocation(program, "TemporalReuse"), settings.temporalReuse);
+		glProgramUniform1f(program, glGetUniformLocation(program, "TemporalLimit"), settings.temporalLimit);
+		glProgramUniform1i(program, glGetUniformLocation(program, "SpatialSamples"), settings.spatialSamples);
+		glProgramUniform1f(program, glGetUniformLocation(program, "SpatialRadius"), settings.spatialRadius);
+		glBindImageTexture(0, temporal.FirstHit(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, temporal.FirstHitNormal(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		// unused before the second view, the current first hits stand in
+		glBindImageTexture(2, reuseAcrossViews ? temporal.ReplacedFirstHit() : temporal.FirstHit(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, reuseAcrossViews ? temporal.ReplacedFirstHitNormal() : temporal.FirstHitNormal(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		glUseProgram(program);
+		for (const bool spatial : {false, true}) {
+			glProgramUniform1i(program, glGetUniformLocation(program, "SpatialPass"), spatial);
+			glDispatchCompute((imageSize.x + RESAMPLE_GROUP_SIZE - 1) / RESAMPLE_GROUP_SIZE, (imageSize.y + RESAMPLE_GROUP_SIZE - 1) / RESAMPLE_GROUP_SIZE, 1);
+			// the spatial pass reads its neighbours' reservoirs, the renderers the ones it leaves
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+		glUseProgram(0);
+	}
+
+private:
+	const std::vector<const char*> paths;
+	const glm::ivec2 imageSize;
+	GLuint program = 0;
+	std::unique_ptr<ProgramBuild> build;
+
+	SSBO reservoirBuffer;
+	GLuint resampleFrame = 0;
+};
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+#include <span>
 #include <vector>
 
 #include "glad/glad.h"
@@ -8,13 +10,15 @@ class SSBO {
 public:
 	explicit SSBO(int index) : index(index) {
 		glGenBuffers(1, &handle);
+		// Bind a small empty buffer so the shader sees zero length arrays until data arrives
+		BufferData(std::vector<std::byte>(16).data(), 16);
 	}
 
 	~SSBO() {
 		glDeleteBuffers(1, &handle);
 	}
 
-	void BufferData(const std::vector<std::shared_ptr<ShaderStruct>>& data) const {
+	void BufferData(const std::vector<std::shared_ptr<ShaderStruct>>& data) {
 		if (data.empty()) return;
 		std::vector<std::vector<std::byte>> bytes;
 		size_t totalSize = 0;
@@ -29,14 +33,64 @@ public:
 			std::memcpy(ptr, structBytes.data(), structBytes.size());
 			ptr += structBytes.size();
 		}
+		BufferData(_data.data(), _data.size());
+	}
+
+	// Uploads data that is already laid out for the shader, e.g. straight from a mapped file
+	template<typename T>
+	void BufferData(std::span<const T> data) {
+		BufferData(data.data(), data.size_bytes());
+	}
+
+	void BufferData(const void* data, size_t size) {
+		if (size == 0) return;
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(_data.size()), _data.data(), GL_STATIC_READ);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(size), data, GL_STATIC_READ);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, handle);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		capacity = size;
 	}
 
+	// Grows the buffer to hold at least size bytes, keeping its contents
+	void Reserve(size_t size) {
+		if (size <= capacity) return;
+		const size_t newCapacity = std::max(size, 2 * capacity);
+		GLuint newHandle;
+		glGenBuffers(1, &newHandle);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+		glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(newCapacity), nullptr, GL_STATIC_READ);
+		glBindBuffer(GL_COPY_READ_BUFFER, handle);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(capacity));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &handle);
+		handle = newHandle;
+		capacity = newCapacity;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, handle);
+	}
+
+	// Writes into an already allocated range of the buffer
+	void BufferSubData(size_t offset, const void* data, size_t size) const {
+		if (size == 0) return;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Reads back what the shader wrote, callers have to issue the matching memory barrier first
+	void GetBufferSubData(size_t offset, void* data, size_t size) const {
+		if (size == 0) return;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size), data);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// For binding the buffer to other targets, e.g. as indirect dispatch arguments. Changes when Reserve grows it.
+	[[nodiscard]] GLuint Handle() const { return handle; }
+
 private:
 	GLuint handle = -1;
 	int index;
+	size_t capacity = 0;
 };
 
@@ -0,0 +1,225 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cluster.h"
+#include "Geometry.h"
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "ShaderStructs.h"
+
+// Binary scene cache (.rtscene). Every section is stored exactly as it is uploaded, so a cache hit only has to
+// map the file and hand the sections to the SSBOs. Bump the version whenever a section layout changes.
+constexpr char SCENE_CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_CACHE_VERSION = 6;
+constexpr uint64_t SCENE_CACHE_ALIGNMENT = 64;
+
+enum SceneCacheSection : uint32_t {
+	POSITIONS_SECTION,
+	NORMALS_SECTION,
+	TEXCOORDS_SECTION,
+	INDICES_SECTION,
+	BVH_NODES_SECTION,
+	MESHES_SECTION,
+	MATERIALS_SECTION,
+	NAMES_SECTION,
+	CLUSTERS_SECTION,
+	MODELS_SECTION,
+	SECTION_COUNT
+};
+
+struct SceneCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sectionCount;
+	uint64_t sourceHash;
+	struct {
+		uint64_t offset, size;
+	} sections[SECTION_COUNT];
+};
+
+struct MeshRecord {
+	glm::mat4 transform;
+	int32_t firstTriangleIndex, nTriangle, materialIndex, rootNodeIndex;
+	uint32_t visible, nameOffset, nameLength, lodCount;
+	MeshLOD lods[MESH_LOD_COUNT - 1];
+};
+
+struct MaterialRecord {
+	glm::vec3 albedo, emissionColor;
+	float strength, roughness, metallic, ior;
+	int32_t albedoTexture, roughnessTexture, metallicTexture;
+	uint32_t nameOffset, nameLength;
+};
+
+// Where a model's data sits in the scene wide streams, so it can be reloaded on its own
+struct ModelRecord {
+	// index into the scene's model paths
+	uint32_t modelIndex;
+	uint32_t firstVertex, vertexCount;
+	uint32_t firstTriangle, triangleCount;
+	uint32_t firstNode, nodeCount;
+	uint32_t firstMesh, meshCount;
+	uint32_t firstMaterial, materialCount;
+};
+
+// Writes the cache from one or more geometry pieces that are laid out back to back, returns false on failure.
+// Clustered geometry comes with its cluster records, they are empty otherwise.
+static bool WriteSceneCache(const char* filePath, uint64_t sourceHash, const std::vector<const Geometry*> &geometries,
+	const std::vector<std::shared_ptr<Mesh>> &meshes, const std::vector<std::shared_ptr<Material>> &materials,
+	std::span<const ClusterRecord> clusters = {}, std::span<const ModelRecord> models = {})
+{
+	std::string names;
+	auto addName = [&](const std::string &name) {
+		const auto offset = static_cast<uint32_t>(names.size());
+		names += name;
+		return offset;
+	};
+
+	std::vector<MeshRecord> meshRecords;
+	for (const auto &mesh : meshes) {
+		MeshRecord &record = meshRecords.emplace_back(MeshRecord{
+			mesh->transform,
+			mesh->firstTriangleIndex, mesh->nTriangle, mesh->materialIndex, mesh->rootNodeIndex,
+			mesh->visible, addName(mesh->name), static_cast<uint32_t>(mesh->name.size()),
+			static_cast<uint32_t>(std::min<size_t>(mesh->lods.size(), MESH_LOD_COUNT - 1)), {}
+		});
+		std::copy_n(mesh->lods.begin(), record.lodCount, record.lods);
+	}
+	std::vector<MaterialRecord> materialRecords;
+	for (const auto &material : materials)
+		materialRecords.push_back({
+			material->albedo, material->emissionColor,
+			material->strength, material->roughness, material->metallic, material->ior,
+			material->albedoTexture, material->roughnessTexture, material->metallicTexture,
+			addName(material->name), static_cast<uint32_t>(material->name.size())
+		});
+
+	// every section is a list of chunks written back to back
+	std::vector<std::pair<const void*, size_t>> sections[SECTION_COUNT];
+	for (const Geometry *geometry : geometries) {
+		sections[POSITIONS_SECTION].emplace_back(geometry->positions.data(), geometry->positions.size_bytes());
+		sections[NORMALS_SECTION].emplace_back(geometry->normals.data(), geometry->normals.size_bytes());
+		sections[TEXCOORDS_SECTION].emplace_back(geometry->texcoords.data(), geometry->texcoords.size_bytes());
+		sections[INDICES_SECTION].emplace_back(geometry->indices.data(), geometry->indices.size_bytes());
+		sections[BVH_NODES_SECTION].emplace_back(geometry->nodes.data(), geometry->nodes.size_bytes());
+	}
+	sections[MESHES_SECTION].emplace_back(meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+	sections[MATERIALS_SECTION].emplace_back(materialRecords.data(), materialRecords.size() * sizeof(MaterialRecord));
+	sections[NAMES_SECTION].emplace_back(names.data(), names.size());
+	sections[CLUSTERS_SECTION].emplace_back(clusters.data(), clusters.size_bytes());
+	sections[MODELS_SECTION].emplace_back(models.data(), models.size_bytes());
+
+	SceneCacheHeader header{};
+	std::memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_CACHE_VERSION;
+	header.sectionCount = SECTION_COUNT;
+	header.sourceHash = sourceHash;
+	uint64_t offset = sizeof(SceneCacheHeader);
+	for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+		offset = (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+		uint64_t size = 0;
+		for (const auto &chunk : sections[i])
+			size += chunk.second;
+		header.sections[i] = {offset, size};
+		offset += size;
+	}
+
+	// Write to a temporary file first so a crash never leaves a half written cache behind
+	const std::filesystem::path path(filePath);
+	std::filesystem::path temporaryPath = path;
+	temporaryPath += ".tmp";
+	std::error_code error;
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), error);
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+			const std::vector<char> padding(header.sections[i].offset - static_cast<uint64_t>(file.tellp()), 0);
+			file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+			for (const auto &[data, size] : sections[i])
+				file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		}
+		if (!file) return false;
+	}
+	std::filesystem::rename(temporaryPath, path, error);
+	return !error;
+}
+
+template<typename T>
+static std::span<const T> SceneCacheView(const MappedFile &file, const SceneCacheHeader &header, SceneCacheSection section)
+{
+	return {
+		reinterpret_cast<const T*>(file.Data() + header.sections[section].offset),
+		static_cast<size_t>(header.sections[section].size / sizeof(T))
+	};
+}
+
+// Maps the cache and points the geometry at it. Fails if the cache is missing, from another version or was
+// built from different sources. The mapping has to outlive the geometry.
+static bool LoadSceneCache(const char* filePath, uint64_t sourceHash, MappedFile &file, Geometry &geometry,
+	std::vector<std::shared_ptr<Mesh>> &meshes, std::vector<std::shared_ptr<Material>> &materials,
+	std::vector<ClusterRecord> &clusters, std::vector<ModelRecord> &models)
+{
+	MappedFile mapping(filePath);
+	if (!mapping.IsOpen() || mapping.Size() < sizeof(SceneCacheHeader))
+		return false;
+
+	SceneCacheHeader header;
+	std::memcpy(&header, mapping.Data(), sizeof(header));
+	if (std::memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != SCENE_CACHE_VERSION ||
+		header.sectionCount != SECTION_COUNT ||
+		header.sourceHash != sourceHash)
+		return false;
+	for (const auto &section : header.sections)
+		if (section.offset % SCENE_CACHE_ALIGNMENT != 0 || section.offset + section.size > mapping.Size())
+			return false;
+
+	geometry.positions = SceneCacheView<float>(mapping, header, POSITIONS_SECTION);
+	geometry.normals = SceneCacheView<float>(mapping, header, NORMALS_SECTION);
+	geometry.texcoords = SceneCacheView<float>(mapping, header, TEXCOORDS_SECTION);
+	geometry.indices = SceneCacheView<uint32_t>(mapping, header, INDICES_SECTION);
+	geometry.nodes = SceneCacheView<BVHNode>(mapping, header, BVH_NODES_SECTION);
+	const auto names = SceneCacheView<char>(mapping, header, NAMES_SECTION);
+	auto name = [&](uint32_t offset, uint32_t length) {
+		return offset + length <= names.size() ? std::string(names.data() + offset, length) : std::string();
+	};
+
+	for (const MeshRecord &record : SceneCacheView<MeshRecord>(mapping, header, MESHES_SECTION)) {
+		auto mesh = std::make_shared<Mesh>(record.firstTriangleIndex, record.nTriangle, record.materialIndex,
+			record.visible != 0, name(record.nameOffset, record.nameLength));
+		mesh->rootNodeIndex = record.rootNodeIndex;
+		mesh->lods.assign(record.lods, record.lods + std::min<uint32_t>(record.lodCount, MESH_LOD_COUNT - 1));
+		mesh->transform = record.transform;
+		meshes.push_back(mesh);
+	}
+	for (const MaterialRecord &record : SceneCacheView<MaterialRecord>(mapping, header, MATERIALS_SECTION)) {
+		auto material = std::make_shared<Material>(Material{
+			record.albedo, record.emissionColor,
+			record.strength, record.roughness, record.metallic, record.ior,
+			name(record.nameOffset, record.nameLength),
+			static_cast<int>(materials.size())
+		});
+		material->albedoTexture = record.albedoTexture;
+		material->roughnessTexture = record.roughnessTexture;
+		material->metallicTexture = record.metallicTexture;
+		materials.push_back(material);
+	}
+
+	const auto clusterRecords = SceneCacheView<ClusterRecord>(mapping, header, CLUSTERS_SECTION);
+	clusters.assign(clusterRecords.begin(), clusterRecords.end());
+	const auto modelRecords = SceneCacheView<ModelRecord>(mapping, header, MODELS_SECTION);
+	models.assign(modelRecords.begin(), modelRecords.end());
+
+	file = std::move(mapping);
+	return true;
+}
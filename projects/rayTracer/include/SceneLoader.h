@@ -0,0 +1,356 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cluster.h"
+#include "Geometry.h"
+#include "GLBLoader.h"
+#include "Hash.h"
+#include "json.hpp"
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "PLYLoader.h"
+#include "SceneCache.h"
+#include "ShaderStructs.h"
+#include "Simplify.h"
+#include "Texture.h"
+
+// Texture maps are optional and relative to the materials file, their ids come from the texture library
+static void LoadMaterials(const char* filePath, std::vector<std::shared_ptr<Material>> *materials, TextureLibrary *textures) {
+	std::ifstream f(filePath);
+	nlohmann::json data = nlohmann::json::parse(f);
+	int idx = static_cast<int>(materials->size());
+	const std::filesystem::path directory = std::filesystem::path(filePath).parent_path();
+	auto texture = [&](const nlohmann::json &material, const char *key) {
+		return material.contains(key) ? textures->Add((directory / material[key].get<std::string>()).string()) : -1;
+	};
+	for (auto material : data)
+	{
+		auto &added = materials->emplace_back(std::make_shared<Material>(Material{
+			{
+				material["albedo"][0].get<float>(),
+				material["albedo"][1].get<float>(),
+				material["albedo"][2].get<float>()
+			},
+			{
+				material["emissionColor"][0].get<float>(),
+				material["emissionColor"][1].get<float>(),
+				material["emissionColor"][2].get<float>()
+			},
+			material["emissionStrength"].get<float>(),
+			material["roughness"].get<float>(),
+			material["metallic"].get<float>(),
+			material["ior"].get<float>(),
+			material["name"].get<std::string>(),
+			idx++
+		}));
+		added->albedoTexture = texture(material, "albedoMap");
+		added->roughnessTexture = texture(material, "roughnessMap");
+		added->metallicTexture = texture(material, "metallicMap");
+	}
+}
+
+// Appends a model's geometry, picking the loader from the file extension. Models without materials of their own
+// pick theirs from namedMaterials by name.
+static std::vector<std::shared_ptr<Mesh>> LoadModel(const char* path, Geometry *geometry,
+	std::vector<std::shared_ptr<Material>> *materials, const std::vector<std::shared_ptr<Material>> *namedMaterials) {
+	const std::string_view extension = std::string_view(path).substr(std::string_view(path).find_last_of('.') + 1);
+	if (extension == "glb")
+		return loadGLB(path, geometry, materials);
+	if (extension == "ply")
+		return loadPLY(path, geometry);
+	return loadMesh(path, geometry, namedMaterials);
+}
+
+// A self-contained part of the scene. Once published its indices are offset to where it lands in the
+// scene wide buffers, so it can be uploaded on its own.
+struct SceneBatch {
+	Geometry geometry;
+	std::vector<std::shared_ptr<Mesh>> meshes;
+	// materials referenced by this batch's meshes, models without their own use the global material indices
+	std::vector<std::shared_ptr<Material>> materials;
+	// decoded textures of the json materials, set on the batch that carries them
+	std::shared_ptr<TextureLibrary> textures;
+	// index into the loader's model paths, -1 for the json materials and whole scenes
+	int modelIndex = -1;
+	size_t vertexBase = 0, triangleBase = 0, nodeBase = 0;
+	int materialBase = 0;
+
+	[[nodiscard]] size_t ByteSize() const {
+		return geometry.positions.size_bytes() + geometry.normals.size_bytes() + geometry.texcoords.size_bytes() +
+			geometry.indices.size_bytes() + geometry.nodes.size_bytes();
+	}
+
+	void Rebase() {
+		for (uint32_t &index : geometry.indexData)
+			index += static_cast<uint32_t>(vertexBase);
+		for (BVHNode &node : geometry.nodeData)
+			node.leftFirst += static_cast<int32_t>(node.triangleCount > 0 ? triangleBase : nodeBase);
+		for (const auto &mesh : meshes) {
+			mesh->firstTriangleIndex += static_cast<int>(triangleBase);
+			mesh->rootNodeIndex += static_cast<int>(nodeBase);
+			for (MeshLOD &lod : mesh->lods) {
+				lod.firstTriangleIndex += static_cast<int>(triangleBase);
+				lod.rootNodeIndex += static_cast<int>(nodeBase);
+			}
+			if (!materials.empty()) mesh->materialIndex += materialBase;
+		}
+		for (const auto &material : materials)
+			material->index += materialBase;
+		geometry.ViewOwnedData();
+	}
+};
+
+// A model with its LODs and BVHs, ready to be published
+static std::shared_ptr<SceneBatch> LoadModelBatch(const char* path, const std::vector<std::shared_ptr<Material>> &jsonMaterials) {
+	auto batch = std::make_shared<SceneBatch>();
+	batch->meshes = LoadModel(path, &batch->geometry, &batch->materials, &jsonMaterials);
+	BuildMeshLODs(batch->geometry, batch->meshes);
+	BuildMeshBVHs(batch->geometry, batch->meshes);
+	batch->geometry.ViewOwnedData();
+	return batch;
+}
+
+// Loads the scene on background threads: the materials first, then every model in parallel with its LODs and BVHs.
+// Each finished part is published as a SceneBatch for the render thread to upload while it keeps drawing.
+// Uses the scene cache when it matches the sources and writes it otherwise.
+// A clustered scene is cut into clusters for out-of-core rendering, its geometry is never published in batches
+// and only the meshes and materials arrive once it's done, the clusters are paged in from the final geometry.
+class SceneLoader {
+public:
+	SceneLoader(std::string materialsPath, std::vector<std::string> modelPaths, std::string cachePath, bool clustered = false) :
+		materialsPath(std::move(materialsPath)), modelPaths(std::move(modelPaths)), cachePath(std::move(cachePath)),
+		clustered(clustered), totalSteps(static_cast<int>(this->modelPaths.size()) + 3) {}
+
+	~SceneLoader() {
+		cancelled = true;
+		if (thread.joinable()) thread.join();
+	}
+
+	SceneLoader(const SceneLoader&) = delete;
+	SceneLoader& operator=(const SceneLoader&) = delete;
+
+	void Start() {
+		thread = std::thread(&SceneLoader::Run, this);
+	}
+
+	// Next batch ready for upload, nullptr if there is none yet
+	std::shared_ptr<SceneBatch> PopBatch() {
+		std::lock_guard lock(mutex);
+		if (ready.empty()) return nullptr;
+		auto batch = ready.front();
+		ready.pop_front();
+		return batch;
+	}
+
+	// True once every batch has been published and the final geometry is available
+	[[nodiscard]] bool IsFinished() const { return finished; }
+	[[nodiscard]] float Progress() const { return static_cast<float>(completedSteps) / static_cast<float>(totalSteps); }
+	[[nodiscard]] size_t PublishedBytes() const { return publishedBytes; }
+
+	[[nodiscard]] std::string Status() const {
+		std::lock_guard lock(mutex);
+		return status;
+	}
+
+	// The whole scene as one geometry, viewing the scene cache mapping when there is one
+	Geometry TakeGeometry() { return std::move(geometry); }
+	MappedFile TakeCacheFile() { return std::move(cacheFile); }
+	// Cluster records of a clustered scene, empty otherwise
+	std::vector<ClusterRecord> TakeClusters() { return std::move(clusters); }
+	// Where each model landed, in publish order. Empty for a clustered scene, its models are cut into clusters.
+	std::vector<ModelRecord> TakeModels() { return std::move(models); }
+	// The json materials come first, followed by the models' own
+	[[nodiscard]] size_t JsonMaterialCount() const { return jsonMaterialCount; }
+
+private:
+	void SetStatus(std::string text) {
+		std::lock_guard lock(mutex);
+		status = std::move(text);
+	}
+
+	void Publish(const std::shared_ptr<SceneBatch> &batch) {
+		batch->vertexBase = vertexCount;
+		batch->triangleBase = triangleCount;
+		batch->nodeBase = nodeCount;
+		batch->materialBase = materialCount;
+		batch->Rebase();
+		if (batch->modelIndex >= 0 && !clustered)
+			models.push_back({
+				static_cast<uint32_t>(batch->modelIndex),
+				static_cast<uint32_t>(vertexCount), static_cast<uint32_t>(batch->geometry.positions.size() / 3),
+				static_cast<uint32_t>(triangleCount), static_cast<uint32_t>(batch->geometry.indices.size() / 3),
+				static_cast<uint32_t>(nodeCount), static_cast<uint32_t>(batch->geometry.nodes.size()),
+				static_cast<uint32_t>(meshCount), static_cast<uint32_t>(batch->meshes.size()),
+				static_cast<uint32_t>(materialCount), static_cast<uint32_t>(batch->materials.size())
+			});
+		vertexCount += batch->geometry.positions.size() / 3;
+		triangleCount += batch->geometry.indices.size() / 3;
+		nodeCount += batch->geometry.nodes.size();
+		meshCount += batch->meshes.size();
+		materialCount += static_cast<int>(batch->materials.size());
+		published.push_back(batch);
+		// clustered geometry only becomes available once all of it is cut into clusters
+		if (!clustered) PushReady(batch);
+	}
+
+	void PushReady(const std::shared_ptr<SceneBatch> &batch) {
+		publishedBytes += batch->ByteSize();
+		std::lock_guard lock(mutex);
+		ready.push_back(batch);
+	}
+
+	static Geometry MergeGeometry(const std::vector<const Geometry*> &geometries) {
+		Geometry merged;
+		for (const Geometry *piece : geometries) {
+			merged.positionData.insert(merged.positionData.end(), piece->positions.begin(), piece->positions.end());
+			merged.normalData.insert(merged.normalData.end(), piece->normals.begin(), piece->normals.end());
+			merged.texcoordData.insert(merged.texcoordData.end(), piece->texcoords.begin(), piece->texcoords.end());
+			merged.indexData.insert(merged.indexData.end(), piece->indices.begin(), piece->indices.end());
+			merged.nodeData.insert(merged.nodeData.end(), piece->nodes.begin(), piece->nodes.end());
+		}
+		merged.ViewOwnedData();
+		return merged;
+	}
+
+	void Run() {
+		// the json materials come first, models without materials of their own index them directly.
+		// They name the textures, which take part in the hash since their ids depend on the images.
+		SetStatus("Parsing materials");
+		auto textures = std::make_shared<TextureLibrary>();
+		auto materialBatch = std::make_shared<SceneBatch>();
+		LoadMaterials(materialsPath.c_str(), &materialBatch->materials, textures.get());
+		jsonMaterialCount = materialBatch->materials.size();
+
+		SetStatus("Hashing sources");
+		Hasher hasher;
+		hasher.UpdateFile(materialsPath.c_str());
+		for (const auto &path : modelPaths)
+			hasher.UpdateFile(path.c_str());
+		for (const TextureImage &image : textures->images)
+			hasher.UpdateFile(image.path.c_str());
+		if (clustered) hasher.Update("clustered");
+		const uint64_t hash = hasher.Digest();
+		++completedSteps;
+
+		SetStatus("Decoding textures");
+		textures->Load();
+
+		// A cache hit is already in its final layout and only needs uploading
+		auto cached = std::make_shared<SceneBatch>();
+		if (LoadSceneCache(cachePath.c_str(), hash, cacheFile, cached->geometry, cached->meshes, cached->materials, clusters, models)) {
+			geometry = cached->geometry;
+			cached->textures = textures;
+			if (clustered) cached->geometry = {};
+			PushReady(cached);
+			SetStatus("Loaded scene cache");
+			completedSteps = totalSteps;
+			finished = true;
+			return;
+		}
+
+		materialBatch->textures = textures;
+		Publish(materialBatch);
+		++completedSteps;
+
+		SetStatus("Parsing models");
+		std::vector<std::future<std::shared_ptr<SceneBatch>>> tasks;
+		for (size_t i = 0; i < modelPaths.size(); ++i)
+			tasks.push_back(std::async(std::launch::async, [path = modelPaths[i], i, jsonMaterials = materialBatch->materials] {
+				auto batch = LoadModelBatch(path.c_str(), jsonMaterials);
+				batch->modelIndex = static_cast<int>(i);
+				return batch;
+			}));
+		// publish models in the order they finish
+		while (!tasks.empty()) {
+			for (auto it = tasks.begin(); it != tasks.end();) {
+				if (it->wait_for(std::chrono::milliseconds(1)) != std::future_status::ready) {
+					++it;
+					continue;
+				}
+				auto batch = it->get();
+				it = tasks.erase(it);
+				if (!cancelled) Publish(batch);
+				++completedSteps;
+			}
+		}
+		if (cancelled) return;
+
+		SetStatus("Writing scene cache");
+		std::vector<const Geometry*> geometries;
+		std::vector<std::shared_ptr<Mesh>> meshes;
+		std::vector<std::shared_ptr<Material>> materials;
+		for (const auto &batch : published) {
+			geometries.push_back(&batch->geometry);
+			meshes.insert(meshes.end(), batch->meshes.begin(), batch->meshes.end());
+			materials.insert(materials.end(), batch->materials.begin(), batch->materials.end());
+		}
+
+		// Building the clusters needs the whole scene in memory once, afterwards it's paged from the cache
+		Geometry clusteredGeometry;
+		if (clustered) {
+			SetStatus("Building clusters");
+			BuildClusters(MergeGeometry(geometries), meshes, clusteredGeometry, clusters);
+			geometries = {&clusteredGeometry};
+		}
+
+		// Read the scene back from the written cache so the batches can be dropped as soon as they are uploaded,
+		// only keep a merged copy if the cache could not be written
+		auto finalBatch = std::make_shared<SceneBatch>();
+		if (clustered) finalBatch->textures = textures;
+		if (WriteSceneCache(cachePath.c_str(), hash, geometries, meshes, materials, clusters, models) &&
+			LoadSceneCache(cachePath.c_str(), hash, cacheFile, geometry, finalBatch->meshes, finalBatch->materials, clusters, models)) {
+			if (clustered) PushReady(finalBatch);
+		}
+		else {
+			geometry = clustered ? std::move(clusteredGeometry) : MergeGeometry(geometries);
+			geometry.ViewOwnedData();
+			if (clustered) {
+				finalBatch->meshes = meshes;
+				finalBatch->materials = materials;
+				PushReady(finalBatch);
+			}
+		}
+		published.clear();
+
+		SetStatus("Done");
+		++completedSteps;
+		finished = true;
+	}
+
+	std::string materialsPath;
+	std::vector<std::string> modelPaths;
+	std::string cachePath;
+	const bool clustered;
+
+	std::thread thread;
+	mutable std::mutex mutex;
+	std::deque<std::shared_ptr<SceneBatch>> ready;
+	std::string status;
+	std::atomic<bool> finished = false, cancelled = false;
+	std::atomic<int> completedSteps = 0;
+	const int totalSteps;
+	std::atomic<size_t> publishedBytes = 0;
+
+	// only touched by the loader thread
+	std::vector<std::shared_ptr<SceneBatch>> published;
+	size_t vertexCount = 0, triangleCount = 0, nodeCount = 0, meshCount = 0;
+	int materialCount = 0;
+
+	// handed to the render thread once finished
+	Geometry geometry;
+	MappedFile cacheFile;
+	std::vector<ClusterRecord> clusters;
+	std::vector<ModelRecord> models;
+	size_t jsonMaterialCount = 0;
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "Geometry.h"
+#include "Mesh.h"
+#include "SceneCache.h"
+#include "SceneLoader.h"
+
+enum GeometryStream {
+	POSITION_STREAM,
+	NORMAL_STREAM,
+	TEXCOORD_STREAM,
+	INDEX_STREAM,
+	NODE_STREAM,
+	GEOMETRY_STREAM_COUNT
+};
+
+// Bytes of a stream that have to be re-uploaded, none if size is 0
+struct StreamRange {
+	size_t offset = 0, size = 0;
+
+	void Extend(size_t begin, size_t end) {
+		if (begin >= end) return;
+		if (size > 0) {
+			end = std::max(end, offset + size);
+			begin = std::min(begin, offset);
+		}
+		offset = begin;
+		size = end - begin;
+	}
+};
+
+// What a model reload touched
+struct ModelReload {
+	StreamRange streams[GEOMETRY_STREAM_COUNT];
+	// meshes to re-upload, every one if their count changed
+	size_t firstDirtyMesh = 0, dirtyMeshEnd = 0;
+	bool meshCountChanged = false;
+};
+
+// Replaces count elements at first. Same sized replacements only report the elements that differ, anything
+// else moves the rest of the stream and reports it from first on.
+template<typename T>
+static StreamRange SpliceStream(std::vector<T> &data, size_t first, size_t count, std::span<const T> replacement) {
+	StreamRange range;
+	if (replacement.size() == count) {
+		auto differs = [&](size_t i) { return std::memcmp(&data[first + i], &replacement[i], sizeof(T)) != 0; };
+		size_t begin = 0, end = count;
+		while (begin < end && !differs(begin)) ++begin;
+		while (end > begin && !differs(end - 1)) --end;
+		std::copy(replacement.begin() + begin, replacement.begin() + end, data.begin() + first + begin);
+		range.Extend((first + begin) * sizeof(T), (first + end) * sizeof(T));
+		return range;
+	}
+	data.erase(data.begin() + first, data.begin() + first + count);
+	data.insert(data.begin() + first, replacement.begin(), replacement.end());
+	range.Extend(first * sizeof(T), data.size() * sizeof(T));
+	return range;
+}
+
+// Swaps a model's part of the scene for a freshly loaded batch, moving the models behind it if its size changed.
+// Meshes keep the material and visibility they were given in the viewer as long as the model has as many.
+// The batch's own materials are left for the caller, they only fit if the model still has as many.
+static ModelReload ReplaceModel(Geometry &scene, std::vector<std::shared_ptr<Mesh>> &sceneMeshes,
+	std::vector<ModelRecord> &models, size_t slot, SceneBatch &batch)
+{
+	ModelRecord &model = models[slot];
+	batch.vertexBase = model.firstVertex;
+	batch.triangleBase = model.firstTriangle;
+	batch.nodeBase = model.firstNode;
+	batch.materialBase = static_cast<int>(model.firstMaterial);
+	batch.Rebase();
+
+	const Geometry &replacement = batch.geometry;
+	const auto vertexCount = static_cast<uint32_t>(replacement.positions.size() / 3);
+	const auto triangleCount = static_cast<uint32_t>(replacement.indices.size() / 3);
+	const auto nodeCount = static_cast<uint32_t>(replacement.nodes.size());
+	const int64_t vertexDelta = static_cast<int64_t>(vertexCount) - model.vertexCount;
+	const int64_t triangleDelta = static_cast<int64_t>(triangleCount) - model.triangleCount;
+	const int64_t nodeDelta = static_cast<int64_t>(nodeCount) - model.nodeCount;
+
+	ModelReload reload;
+	scene.TakeOwnership();
+	reload.streams[POSITION_STREAM] = SpliceStream(scene.positionData, 3 * static_cast<size_t>(model.firstVertex), 3 * static_cast<size_t>(model.vertexCount), replacement.positions);
+	reload.streams[NORMAL_STREAM] = SpliceStream(scene.normalData, 3 * static_cast<size_t>(model.firstVertex), 3 * static_cast<size_t>(model.vertexCount), replacement.normals);
+	reload.streams[TEXCOORD_STREAM] = SpliceStream(scene.texcoordData, 2 * static_cast<size_t>(model.firstVertex), 2 * static_cast<size_t>(model.vertexCount), replacement.texcoords);
+	reload.streams[INDEX_STREAM] = SpliceStream(scene.indexData, 3 * static_cast<size_t>(model.firstTriangle), 3 * static_cast<size_t>(model.triangleCount), replacement.indices);
+	reload.streams[NODE_STREAM] = SpliceStream(scene.nodeData, model.firstNode, model.nodeCount, replacement.nodes);
+
+	// the models behind this one move with it
+	const size_t laterIndices = 3 * (static_cast<size_t>(model.firstTriangle) + triangleCount);
+	if (vertexDelta != 0) {
+		for (size_t i = laterIndices; i < scene.indexData.size(); ++i)
+			scene.indexData[i] = static_cast<uint32_t>(scene.indexData[i] + vertexDelta);
+		reload.streams[INDEX_STREAM].Extend(laterIndices * sizeof(uint32_t), scene.indexData.size() * sizeof(uint32_t));
+	}
+	const size_t laterNodes = static_cast<size_t>(model.firstNode) + nodeCount;
+	if (triangleDelta != 0 || nodeDelta != 0) {
+		for (size_t i = laterNodes; i < scene.nodeData.size(); ++i) {
+			BVHNode &node = scene.nodeData[i];
+			node.leftFirst = static_cast<int32_t>(node.leftFirst + (node.triangleCount > 0 ? triangleDelta : nodeDelta));
+		}
+		reload.streams[NODE_STREAM].Extend(laterNodes * sizeof(BVHNode), scene.nodeData.size() * sizeof(BVHNode));
+	}
+	scene.ViewOwnedData();
+
+	// swap the meshes
+	const auto firstMesh = sceneMeshes.begin() + model.firstMesh;
+	if (batch.meshes.size() == model.meshCount) {
+		for (size_t i = 0; i < batch.meshes.size(); ++i) {
+			batch.meshes[i]->materialIndex = firstMesh[static_cast<std::ptrdiff_t>(i)]->materialIndex;
+			batch.meshes[i]->visible = firstMesh[static_cast<std::ptrdiff_t>(i)]->visible;
+		}
+		std::copy(batch.meshes.begin(), batch.meshes.end(), firstMesh);
+	}
+	else {
+		// without matching materials the meshes fall back to the model's old ones
+		if (!batch.materials.empty() && batch.materials.size() != model.materialCount)
+			for (const auto &mesh : batch.meshes)
+				mesh->materialIndex = model.materialCount == 0 ? 0 : std::clamp(mesh->materialIndex,
+					static_cast<int>(model.firstMaterial), static_cast<int>(model.firstMaterial + model.materialCount) - 1);
+		sceneMeshes.erase(firstMesh, firstMesh + model.meshCount);
+		sceneMeshes.insert(sceneMeshes.begin() + model.firstMesh, batch.meshes.begin(), batch.meshes.end());
+		reload.meshCountChanged = true;
+	}
+	for (size_t i = model.firstMesh + batch.meshes.size(); i < sceneMeshes.size(); ++i) {
+		Mesh &mesh = *sceneMeshes[i];
+		mesh.firstTriangleIndex = static_cast<int>(mesh.firstTriangleIndex + triangleDelta);
+		mesh.rootNodeIndex = static_cast<int>(mesh.rootNodeIndex + nodeDelta);
+		for (MeshLOD &lod : mesh.lods) {
+			lod.firstTriangleIndex = static_cast<int32_t>(lod.firstTriangleIndex + triangleDelta);
+			lod.rootNodeIndex = static_cast<int32_t>(lod.rootNodeIndex + nodeDelta);
+		}
+	}
+	reload.firstDirtyMesh = model.firstMesh;
+	reload.dirtyMeshEnd = triangleDelta != 0 || nodeDelta != 0 ? sceneMeshes.size() : model.firstMesh + batch.meshes.size();
+
+	const auto meshDelta = static_cast<int64_t>(batch.meshes.size()) - model.meshCount;
+	for (size_t i = slot + 1; i < models.size(); ++i) {
+		models[i].firstVertex = static_cast<uint32_t>(models[i].firstVertex + vertexDelta);
+		models[i].firstTriangle = static_cast<uint32_t>(models[i].firstTriangle + triangleDelta);
+		models[i].firstNode = static_cast<uint32_t>(models[i].firstNode + nodeDelta);
+		models[i].firstMesh = static_cast<uint32_t>(models[i].firstMesh + meshDelta);
+	}
+	model.vertexCount = vertexCount;
+	model.triangleCount = triangleCount;
+	model.nodeCount = nodeCount;
+	model.meshCount = static_cast<uint32_t>(batch.meshes.size());
+	return reload;
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glad/glad.h"
+#include "ProgramCache.h"
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, glad is generated without extensions
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Set once the driver compiles and links in the background, until then checking a program's status waits for it
+inline bool parallelShaderCompile = false;
+
+// Lets the driver use as many compiler threads as it likes, maxThreads comes from either extension
+static void EnableParallelShaderCompile(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads) {
+	if (!maxThreads) return;
+	maxThreads(0xFFFFFFFF);
+	parallelShaderCompile = true;
+}
+
+static bool ReadShaderSources(const std::vector<const char*> &paths, std::vector<std::string> &sources) {
+	sources.clear();
+	for (const char *path : paths) {
+		std::ifstream file(path);
+		if (!file.is_open()) return false;
+		std::stringstream stream;
+		stream << file.rdbuf();
+		sources.push_back(stream.str());
+	}
+	return true;
+}
+
+static std::string ShaderInfoLog(GLuint shader) {
+	GLint length = 0;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+	std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+	glGetShaderInfoLog(shader, length, nullptr, log.data());
+	return log.c_str();
+}
+
+static std::string ProgramInfoLog(GLuint program) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+	std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+	glGetProgramInfoLog(program, length, nullptr, log.data());
+	return log.c_str();
+}
+
+// Only queues the compile, its status and log are read once the program is linked
+static void LoadShader(const GLuint shader, const std::vector<std::string> &sources) {
+	std::vector<const char*> sourceCode;
+	for (const auto &source : sources) sourceCode.push_back(source.c_str());
+	glShaderSource(shader, static_cast<int>(sourceCode.size()), sourceCode.data(), nullptr);
+	glCompileShader(shader);
+}
+
+enum class ProgramStatus { PENDING, READY, FAILED };
+
+// The source files of one shader stage, compiled as if they were concatenated
+struct ShaderStage {
+	GLenum type;
+	std::vector<const char*> paths;
+	// prepended to the sources after the first one, which holds the #version line. They start on a line of their
+	// own, the version file doesn't end with a newline.
+	std::string defines;
+};
+
+// A program being compiled and linked from its stages. Starting it never waits for the driver, Poll reports
+// whether it is done without waiting when the driver compiles in parallel.
+// A program found in the binary cache is ready straight away.
+class ProgramBuild {
+public:
+	ProgramBuild(const std::vector<ShaderStage> &stages, std::string cachePath) : cachePath(std::move(cachePath))
+	{
+		std::vector<std::vector<std::string>> sources(stages.size());
+		for (size_t i = 0; i < stages.size(); ++i) {
+			if (!ReadShaderSources(stages[i].paths, sources[i])) {
+				status = ProgramStatus::FAILED;
+				log = std::string("Failed to read the shader sources of ") + stages[i].paths.back();
+				return;
+			}
+			if (!stages[i].defines.empty() && !sources[i].empty())
+				sources[i].insert(sources[i].begin() + 1, "\n" + stages[i].defines);
+		}
+		cacheKey = ProgramCacheKey(sources);
+		if ((program = LoadProgramBinary(this->cachePath.c_str(), cacheKey))) {
+			status = ProgramStatus::READY;
+			return;
+		}
+
+		program = glCreateProgram();
+		// lets the binary of this link be cached instead of linking a second time for it
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		for (size_t i = 0; i < stages.size(); ++i) {
+			const GLuint shader = shaders.emplace_back(glCreateShader(stages[i].type));
+			LoadShader(shader, sources[i]);
+			glAttachShader(program, shader);
+		}
+		glLinkProgram(program);
+	}
+
+	~ProgramBuild() {
+		DeleteShaders();
+		if (program) glDeleteProgram(program);
+	}
+
+	ProgramBuild(const ProgramBuild&) = delete;
+	ProgramBuild& operator=(const ProgramBuild&) = delete;
+
+	// wait blocks until the driver is done
+	ProgramStatus Poll(bool wait = false) {
+		if (status != ProgramStatus::PENDING) return status;
+		if (parallelShaderCompile && !wait) {
+			GLint completed = GL_FALSE;
+			glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+			if (!completed) return status;
+		}
+
+		GLint success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (success) {
+			SaveProgramBinary(cachePath.c_str(), cacheKey, program);
+			status = ProgramStatus::READY;
+		}
+		else {
+			for (const GLuint shader : shaders) {
+				GLint compiled;
+				glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+				if (!compiled) log += ShaderInfoLog(shader);
+			}
+			log += ProgramInfoLog(program);
+			glDeleteProgram(program);
+			program = 0;
+			status = ProgramStatus::FAILED;
+		}
+		DeleteShaders();
+		return status;
+	}
+
+	// Hands the linked program over, the build no longer deletes it
+	GLuint Take() {
+		return std::exchange(program, 0);
+	}
+
+	// The compile and link errors of a failed build
+	[[nodiscard]] const std::string& Log() const { return log; }
+
+private:
+	void DeleteShaders() {
+		for (const GLuint shader : shaders)
+			glDeleteShader(shader);
+		shaders.clear();
+	}
+
+	std::string cachePath;
+	uint64_t cacheKey = 0;
+	GLuint program = 0;
+	std::vector<GLuint> shaders;
+	ProgramStatus status = ProgramStatus::PENDING;
+	std::string log;
+};
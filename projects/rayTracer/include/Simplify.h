@@ -0,0 +1,319 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <queue>
+#include <span>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/matrix.hpp>
+
+#include "Geometry.h"
+#include "Mesh.h"
+
+// Meshes with fewer triangles are only traced at full resolution
+constexpr int LOD_MIN_TRIANGLES = 256;
+// Give up on further levels once a level keeps more than this fraction of the previous one
+constexpr float LOD_MIN_REDUCTION = 0.75f;
+
+// Garland-Heckbert error quadric, the area weighted sum of squared distances to a set of planes
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+	double area = 0;
+
+	static Quadric FromPlane(const glm::dvec3 &n, double d, double area) {
+		return {
+			area * n.x * n.x, area * n.x * n.y, area * n.x * n.z, area * n.x * d, area * n.y * n.y,
+			area * n.y * n.z, area * n.y * d, area * n.z * n.z, area * n.z * d, area * d * d, area
+		};
+	}
+
+	Quadric &operator+=(const Quadric &q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+		bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		area += q.area;
+		return *this;
+	}
+
+	[[nodiscard]] double Error(const glm::dvec3 &p) const {
+		return a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x +
+			b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y +
+			c2 * p.z * p.z + 2 * cd * p.z + d2;
+	}
+
+	// Position with the smallest error, false if it isn't unique (e.g. all planes are parallel)
+	bool Optimum(glm::dvec3 &p) const {
+		const glm::dmat3 a(a2, ab, ac, ab, b2, bc, ac, bc, c2);
+		if (std::abs(determinant(a)) < 1e-10) return false;
+		p = inverse(a) * -glm::dvec3(ad, bd, cd);
+		return true;
+	}
+};
+
+// Quadric error edge collapse over one triangle range. Every Simplify call continues from the previous one,
+// so consecutive levels are refinements of each other. Border vertices, including the seams where the OBJ
+// loader splits vertices by normal or texture coordinate, never move so the simplified mesh stays closed where the original was.
+class MeshSimplifier {
+public:
+	MeshSimplifier(const Geometry &geometry, int firstTriangle, int nTriangle) {
+		// a mesh's vertices are mostly contiguous, map them to local ones through a table over their range
+		const std::span<const uint32_t> indices(geometry.indexData.data() + 3 * static_cast<size_t>(firstTriangle),
+			3 * static_cast<size_t>(nTriangle));
+		const auto [minVertex, maxVertex] = std::ranges::minmax(indices);
+		std::vector<uint32_t> localVertex(nTriangle > 0 ? maxVertex - minVertex + 1 : 0, UINT32_MAX);
+		for (int i = 0; i < nTriangle; ++i) {
+			Face face{};
+			for (int j = 0; j < 3; ++j) {
+				const uint32_t vertex = indices[3 * i + j];
+				uint32_t &local = localVertex[vertex - minVertex];
+				if (local == UINT32_MAX) {
+					local = static_cast<uint32_t>(vertices.size());
+					Vertex &v = vertices.emplace_back();
+					v.position = glm::dvec3(glm::make_vec3(&geometry.positionData[3 * static_cast<size_t>(vertex)]));
+					v.normal = glm::make_vec3(&geometry.normalData[3 * static_cast<size_t>(vertex)]);
+					v.texcoord = glm::make_vec2(&geometry.texcoordData[2 * static_cast<size_t>(vertex)]);
+				}
+				face.vertices[j] = local;
+			}
+			if (face.vertices[0] == face.vertices[1] || face.vertices[1] == face.vertices[2] ||
+				face.vertices[2] == face.vertices[0])
+				continue;
+			faces.push_back(face);
+		}
+		liveTriangles = faces.size();
+
+		// Edges used by a single triangle are borders
+		std::vector<uint64_t> edges;
+		edges.reserve(3 * faces.size());
+		for (uint32_t t = 0; t < faces.size(); ++t) {
+			const uint32_t *v = faces[t].vertices;
+			const glm::dvec3 normal = cross(vertices[v[1]].position - vertices[v[0]].position,
+				vertices[v[2]].position - vertices[v[0]].position);
+			const double length = glm::length(normal);
+			const Quadric plane = length > 0.0 ?
+				Quadric::FromPlane(normal / length, -dot(normal / length, vertices[v[0]].position), 0.5 * length) : Quadric{};
+			for (int j = 0; j < 3; ++j) {
+				vertices[v[j]].quadric += plane;
+				vertices[v[j]].triangles.push_back(t);
+				edges.push_back(EdgeKey(v[j], v[(j + 1) % 3]));
+			}
+		}
+		std::ranges::sort(edges);
+		for (size_t i = 0; i < edges.size();) {
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i]) ++j;
+			if (j - i == 1) {
+				vertices[edges[i] >> 32].border = true;
+				vertices[edges[i] & 0xffffffff].border = true;
+			}
+			i = j;
+		}
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		for (const uint64_t edge : edges)
+			Push(static_cast<uint32_t>(edge >> 32), static_cast<uint32_t>(edge & 0xffffffff));
+	}
+
+	[[nodiscard]] size_t TriangleCount() const { return liveTriangles; }
+
+	// Collapses the cheapest edges until at most targetTriangles are left or nothing can collapse any more.
+	// Returns the object space error of the mesh so far, the RMS plane distance of the worst collapse.
+	float Simplify(size_t targetTriangles) {
+		while (liveTriangles > targetTriangles && !collapses.empty()) {
+			const Collapse collapse = collapses.top();
+			collapses.pop();
+			if (vertices[collapse.keep].removed || vertices[collapse.remove].removed ||
+				vertices[collapse.keep].version != collapse.keepVersion ||
+				vertices[collapse.remove].version != collapse.removeVersion)
+				continue;
+			const glm::dvec3 position(collapse.position);
+			if (Flips(collapse.keep, collapse.remove, position) || Flips(collapse.remove, collapse.keep, position))
+				continue;
+			Apply(collapse);
+			// the mean squared distance to the planes merged into the vertex
+			const Quadric &quadric = vertices[collapse.keep].quadric;
+			if (quadric.area > 0.0)
+				maxError = std::max(maxError, collapse.cost / quadric.area);
+		}
+		return static_cast<float>(std::sqrt(std::max(maxError, 0.0)));
+	}
+
+	// Appends the current vertices and triangles to the geometry, returns the index of the first new triangle
+	int Append(Geometry &geometry) const {
+		const int firstTriangle = static_cast<int>(geometry.indexData.size() / 3);
+		std::vector<uint32_t> globalVertex(vertices.size(), UINT32_MAX);
+		for (const Face &face : faces) {
+			if (face.removed) continue;
+			for (const uint32_t vertex : face.vertices) {
+				if (globalVertex[vertex] == UINT32_MAX) {
+					globalVertex[vertex] = static_cast<uint32_t>(geometry.positionData.size() / 3);
+					const glm::vec3 position(vertices[vertex].position);
+					const glm::vec3 &normal = vertices[vertex].normal;
+					const glm::vec2 &texcoord = vertices[vertex].texcoord;
+					geometry.positionData.insert(geometry.positionData.end(), {position.x, position.y, position.z});
+					geometry.normalData.insert(geometry.normalData.end(), {normal.x, normal.y, normal.z});
+					geometry.texcoordData.insert(geometry.texcoordData.end(), {texcoord.x, texcoord.y});
+				}
+				geometry.indexData.push_back(globalVertex[vertex]);
+			}
+		}
+		return firstTriangle;
+	}
+
+private:
+	struct Vertex {
+		glm::dvec3 position;
+		glm::vec3 normal;
+		glm::vec2 texcoord;
+		Quadric quadric;
+		std::vector<uint32_t> triangles;
+		uint32_t version = 0;
+		bool border = false, removed = false;
+	};
+
+	struct Face {
+		uint32_t vertices[3];
+		bool removed = false;
+	};
+
+	// kept small, the queue holds several entries per edge
+	struct Collapse {
+		float cost;
+		uint32_t keep, remove, keepVersion, removeVersion;
+		glm::vec3 position;
+
+		bool operator>(const Collapse &other) const { return cost > other.cost; }
+	};
+
+	static uint64_t EdgeKey(uint32_t a, uint32_t b) {
+		return static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+	}
+
+	// Queues the collapse of edge (a, b) at its cheapest position, borders stay where they are
+	void Push(uint32_t a, uint32_t b) {
+		const Vertex &va = vertices[a], &vb = vertices[b];
+		if (va.border && vb.border) return;
+		if (vb.border) std::swap(a, b);
+
+		Quadric quadric = vertices[a].quadric;
+		quadric += vertices[b].quadric;
+		glm::dvec3 position = vertices[a].position;
+		double cost = quadric.Error(position);
+		if (!vertices[a].border) {
+			glm::dvec3 candidates[3] = {vertices[b].position, (vertices[a].position + vertices[b].position) * 0.5, {}};
+			int candidateCount = 2;
+			// the optimum of a nearly flat neighbourhood can be far away from the edge, only accept it close by
+			if (quadric.Optimum(candidates[2]) &&
+				distance(candidates[2], candidates[1]) <= distance(vertices[a].position, vertices[b].position))
+				candidateCount = 3;
+			for (int i = 0; i < candidateCount; ++i) {
+				const double error = quadric.Error(candidates[i]);
+				if (error < cost) {
+					cost = error;
+					position = candidates[i];
+				}
+			}
+		}
+		collapses.push({static_cast<float>(cost), a, b, vertices[a].version, vertices[b].version, glm::vec3(position)});
+	}
+
+	// True if moving vertex to position would flip or collapse one of its triangles that doesn't contain other
+	[[nodiscard]] bool Flips(uint32_t vertex, uint32_t other, const glm::dvec3 &position) const {
+		for (const uint32_t t : vertices[vertex].triangles) {
+			const Face &face = faces[t];
+			if (face.removed) continue;
+			const uint32_t *v = face.vertices;
+			if (v[0] == other || v[1] == other || v[2] == other) continue;
+
+			glm::dvec3 corners[3], moved[3];
+			for (int j = 0; j < 3; ++j) {
+				corners[j] = vertices[v[j]].position;
+				moved[j] = v[j] == vertex ? position : corners[j];
+			}
+			const glm::dvec3 before = cross(corners[1] - corners[0], corners[2] - corners[0]);
+			const glm::dvec3 after = cross(moved[1] - moved[0], moved[2] - moved[0]);
+			const double lengths = glm::length(before) * glm::length(after);
+			if (lengths <= 0.0 || dot(before, after) < 0.2 * lengths)
+				return true;
+		}
+		return false;
+	}
+
+	void Apply(const Collapse &collapse) {
+		Vertex &keep = vertices[collapse.keep];
+		Vertex &remove = vertices[collapse.remove];
+		// positions start out as floats and only ever move to float positions, so these compare exactly
+		const glm::dvec3 position(collapse.position);
+		if (position == remove.position) {
+			keep.normal = remove.normal;
+			keep.texcoord = remove.texcoord;
+		}
+		else if (position != keep.position) {
+			keep.normal = normalize(keep.normal + remove.normal);
+			keep.texcoord = 0.5f * (keep.texcoord + remove.texcoord);
+		}
+		keep.position = position;
+		keep.quadric += remove.quadric;
+		keep.version++;
+		remove.removed = true;
+
+		for (const uint32_t t : remove.triangles) {
+			Face &face = faces[t];
+			if (face.removed) continue;
+			uint32_t *v = face.vertices;
+			if (v[0] == collapse.keep || v[1] == collapse.keep || v[2] == collapse.keep) {
+				face.removed = true;
+				--liveTriangles;
+				continue;
+			}
+			std::replace(v, v + 3, collapse.remove, collapse.keep);
+			keep.triangles.push_back(t);
+		}
+		remove.triangles = {};
+		std::erase_if(keep.triangles, [&](uint32_t t) { return faces[t].removed; });
+
+		// the neighbourhood changed, requeue every edge around the kept vertex
+		neighbours.clear();
+		for (const uint32_t t : keep.triangles)
+			for (const uint32_t vertex : faces[t].vertices)
+				if (vertex != collapse.keep)
+					neighbours.push_back(vertex);
+		std::ranges::sort(neighbours);
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for (const uint32_t vertex : neighbours)
+			Push(collapse.keep, vertex);
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<Face> faces;
+	size_t liveTriangles = 0;
+	double maxError = 0.0;
+	std::vector<uint32_t> neighbours;
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> collapses;
+};
+
+// Appends up to MESH_LOD_COUNT - 1 simplified levels per distinct triangle range, each with about half the
+// triangles of the one before. Instances of the same geometry share their levels.
+static void BuildMeshLODs(Geometry &geometry, const std::vector<std::shared_ptr<Mesh>> &meshes) {
+	std::map<std::pair<int, int>, std::vector<MeshLOD>> levels;
+	for (const auto &mesh : meshes) {
+		const auto [it, inserted] = levels.try_emplace({mesh->firstTriangleIndex, mesh->nTriangle});
+		if (inserted && mesh->nTriangle >= LOD_MIN_TRIANGLES) {
+			MeshSimplifier simplifier(geometry, mesh->firstTriangleIndex, mesh->nTriangle);
+			size_t previous = simplifier.TriangleCount();
+			for (int level = 1; level < MESH_LOD_COUNT; ++level) {
+				const float error = simplifier.Simplify(previous / 2);
+				const size_t count = simplifier.TriangleCount();
+				if (count == 0 || static_cast<float>(count) > LOD_MIN_REDUCTION * static_cast<float>(previous))
+					break;
+				it->second.push_back({simplifier.Append(geometry), static_cast<int>(count), 0, error});
+				previous = count;
+			}
+		}
+		mesh->lods = it->second;
+	}
+}
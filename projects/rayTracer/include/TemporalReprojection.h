@@ -0,0 +1,143 @@
+#pragma once
+#include <array>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/mat4x4.hpp>
+
+#include "glad/glad.h"
+#include "ComputeFrame.h"
+#include "ShaderProgram.h"
+
+// Must match reproject.comp
+constexpr int REPROJECT_GROUP_SIZE = 8;
+
+// Keeps what the accumulation showed across camera moves instead of starting over from a single noisy sample.
+// Every restart stores the pixels' first hits, the next view takes over the previous accumulation wherever it
+// sees the same surface there. The first hits' position, normal and albedo also guide the denoiser.
+class TemporalReprojection {
+public:
+	TemporalReprojection(std::vector<const char*> paths, glm::ivec2 imageSize) : paths(std::move(paths)), imageSize(imageSize)
+	{
+		glGenTextures(1, &history);
+		glBindTexture(GL_TEXTURE_2D, history);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, imageSize.x, imageSize.y);
+		glGenTextures(1, &firstHitAlbedo);
+		glBindTexture(GL_TEXTURE_2D, firstHitAlbedo);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, imageSize.x, imageSize.y);
+		glGenTextures(2, firstHits.data());
+		glGenTextures(2, firstHitNormals.data());
+		for (int view = 0; view < 2; ++view) {
+			glBindTexture(GL_TEXTURE_2D, firstHits[view]);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, imageSize.x, imageSize.y);
+			glBindTexture(GL_TEXTURE_2D, firstHitNormals[view]);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, imageSize.x, imageSize.y);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		Rebuild();
+		build->Poll(true);
+		const bool built = SwapBuiltPrograms();
+		assert(built);
+	}
+
+	~TemporalReprojection() {
+		glDeleteProgram(program);
+		glDeleteTextures(1, &history);
+		glDeleteTextures(1, &firstHitAlbedo);
+		glDeleteTextures(2, firstHits.data());
+		glDeleteTextures(2, firstHitNormals.data());
+	}
+
+	TemporalReprojection(const TemporalReprojection&) = delete;
+	TemporalReprojection& operator=(const TemporalReprojection&) = delete;
+
+	// The sources of the program, for watching them
+	[[nodiscard]] const std::vector<const char*>& Paths() const { return paths; }
+
+	// Starts building the program again in the background, the running one keeps reprojecting until it linked
+	void Rebuild() {
+		build = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_COMPUTE_SHADER, paths, {}}}, "resources/cache/reproject.rtprogram");
+	}
+
+	// Swaps the rebuilt program in once it is done, keeping the running one if it failed.
+	// Returns true if the program was swapped.
+	bool SwapBuiltPrograms() {
+		if (!build) return false;
+		const ProgramStatus status = build->Poll();
+		if (status == ProgramStatus::PENDING) return false;
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(program);
+			program = build->Take();
+		}
+		else std::cout << "Failed to build the reprojection shader, keeping the previous one:\n" << build->Log() << std::endl;
+		build.reset();
+		return status == ProgramStatus::READY;
+	}
+
+	// Starts the image's accumulation for the frame's view. With reproject it keeps up to maxHistory samples of
+	// the previous view wherever they still apply, otherwise it starts empty.
+	void Restart(GLuint image, const ComputeFrame &frame, const glm::mat4 &viewProjection, bool reproject, float maxHistory) {
+		reproject &= hasHistory;
+		if (reproject) {
+			// the renderers wrote the image with image stores as well
+			glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+			glCopyImageSubData(image, GL_TEXTURE_2D, 0, 0, 0, 0, history, GL_TEXTURE_2D, 0, 0, 0, 0, imageSize.x, imageSize.y, 1);
+		}
+
+		const int view = previousView ^ 1;
+		SetFrameUniforms(program, frame, imageSize);
+		glProgramUniform1i(program, glGetUniformLocation(program, "Reproject"), reproject);
+		glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "PreviousViewProjection"), 1, false, &previousViewProjection[0][0]);
+		glProgramUniform1f(program, glGetUniformLocation(program, "MaxHistory"), maxHistory);
+		glBindImageTexture(0, image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, history, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(2, firstHits[view], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, firstHitNormals[view], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		glBindImageTexture(4, firstHits[previousView], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(5, firstHitNormals[previousView], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+		glBindImageTexture(6, firstHitAlbedo, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		glUseProgram(program);
+		glDispatchCompute((imageSize.x + REPROJECT_GROUP_SIZE - 1) / REPROJECT_GROUP_SIZE, (imageSize.y + REPROJECT_GROUP_SIZE - 1) / REPROJECT_GROUP_SIZE, 1);
+		glUseProgram(0);
+		// the renderers add to the image next, by imageLoad or by blending
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		previousView = view;
+		replacedViewProjection = previousViewProjection;
+		previousViewProjection = viewProjection;
+		hasReplacedView = hasHistory;
+		hasHistory = true;
+	}
+
+	// The current view's first hits, as RGBA32F position and distance, RGBA16F normal and RGBA16F albedo
+	[[nodiscard]] GLuint FirstHit() const { return firstHits[previousView]; }
+	[[nodiscard]] GLuint FirstHitNormal() const { return firstHitNormals[previousView]; }
+	[[nodiscard]] GLuint FirstHitAlbedo() const { return firstHitAlbedo; }
+	// The view the current one replaced, for carrying other per pixel state across camera moves. Only there from
+	// the second restart on.
+	[[nodiscard]] bool HasReplacedView() const { return hasReplacedView; }
+	[[nodiscard]] GLuint ReplacedFirstHit() const { return firstHits[previousView ^ 1]; }
+	[[nodiscard]] GLuint ReplacedFirstHitNormal() const { return firstHitNormals[previousView ^ 1]; }
+	[[nodiscard]] const glm::mat4& ReplacedViewProjection() const { return replacedViewProjection; }
+
+private:
+	const std::vector<const char*> paths;
+	const glm::ivec2 imageSize;
+	GLuint program = 0;
+	std::unique_ptr<ProgramBuild> build;
+
+	// the image as the previous view left it
+	GLuint history = 0;
+	// the first hits of the previous view and the one being started, they swap every restart
+	std::array<GLuint, 2> firstHits{};
+	std::array<GLuint, 2> firstHitNormals{};
+	GLuint firstHitAlbedo = 0;
+	int previousView = 0;
+	glm::mat4 previousViewProjection{1.0f};
+	glm::mat4 replacedViewProjection{1.0f};
+	bool hasHistory = false;
+	bool hasReplacedView = false;
+};
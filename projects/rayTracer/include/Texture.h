@@ -0,0 +1,194 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Textures are resized to squares and packed into one texture array per size, bucket b holds
+// (TEXTURE_MIN_SIZE << b)² textures. Matches the sampler array in raytracing.frag.
+constexpr int TEXTURE_BUCKET_COUNT = 5;
+constexpr int TEXTURE_MIN_SIZE = 128;
+
+// A texture id is its bucket in the high bits and its layer in the low 16, -1 for none
+constexpr int TextureId(int bucket, int layer) { return bucket << 16 | layer; }
+
+// Smallest bucket that holds the image without shrinking it, the largest one for anything bigger
+static int TextureBucket(int width, int height) {
+	int bucket = 0;
+	while (bucket < TEXTURE_BUCKET_COUNT - 1 && (TEXTURE_MIN_SIZE << bucket) < std::max(width, height))
+		++bucket;
+	return bucket;
+}
+
+// 8 bit RGBA, rows from the bottom up like OpenGL expects them
+struct Image {
+	int width = 0, height = 0;
+	std::vector<uint8_t> texels;
+};
+
+// Reads a header line token of a binary PPM, skipping comments
+static bool ReadPPMToken(std::ifstream &file, int &value) {
+	file >> std::ws;
+	while (file.peek() == '#') {
+		std::string comment;
+		std::getline(file, comment);
+		file >> std::ws;
+	}
+	return static_cast<bool>(file >> value);
+}
+
+// Uncompressed or run length encoded 24/32 bit TGA, or binary (P6) PPM. Only reads the header if image is null.
+static bool ReadImage(const char *filePath, int &width, int &height, Image *image) {
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open()) return false;
+
+	char magic[2]{};
+	file.read(magic, 2);
+	if (magic[0] == 'P' && magic[1] == '6') {
+		int maxValue;
+		if (!ReadPPMToken(file, width) || !ReadPPMToken(file, height) || !ReadPPMToken(file, maxValue) ||
+			width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255)
+			return false;
+		if (!image) return true;
+		file.get();
+		std::vector<uint8_t> rgb(3 * static_cast<size_t>(width) * height);
+		if (!file.read(reinterpret_cast<char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()))) return false;
+		image->width = width;
+		image->height = height;
+		image->texels.resize(4 * static_cast<size_t>(width) * height);
+		// PPM rows start at the top
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x) {
+				const uint8_t *source = &rgb[3 * (static_cast<size_t>(height - 1 - y) * width + x)];
+				uint8_t *texel = &image->texels[4 * (static_cast<size_t>(y) * width + x)];
+				for (int c = 0; c < 3; ++c)
+					texel[c] = static_cast<uint8_t>(source[c] * 255 / maxValue);
+				texel[3] = 255;
+			}
+		return true;
+	}
+
+	uint8_t header[18];
+	std::memcpy(header, magic, 2);
+	if (!file.read(reinterpret_cast<char*>(header + 2), 16)) return false;
+	const int type = header[2];
+	const int depth = header[16];
+	width = header[12] | header[13] << 8;
+	height = header[14] | header[15] << 8;
+	if (header[1] != 0 || (type != 2 && type != 10) || (depth != 24 && depth != 32) || width == 0 || height == 0)
+		return false;
+	if (!image) return true;
+
+	file.seekg(18 + header[0]);
+	const int bytes = depth / 8;
+	const size_t count = static_cast<size_t>(width) * height;
+	std::vector<uint8_t> bgra(count * bytes);
+	if (type == 2) {
+		if (!file.read(reinterpret_cast<char*>(bgra.data()), static_cast<std::streamsize>(bgra.size()))) return false;
+	}
+	else {
+		for (size_t i = 0; i < count;) {
+			const int packet = file.get();
+			if (packet < 0) return false;
+			const size_t run = std::min<size_t>((packet & 0x7f) + 1, count - i);
+			if (packet & 0x80) {
+				uint8_t pixel[4];
+				if (!file.read(reinterpret_cast<char*>(pixel), bytes)) return false;
+				for (size_t j = 0; j < run; ++j)
+					std::memcpy(&bgra[(i + j) * bytes], pixel, bytes);
+			}
+			else if (!file.read(reinterpret_cast<char*>(&bgra[i * bytes]), static_cast<std::streamsize>(run * bytes)))
+				return false;
+			i += run;
+		}
+	}
+
+	image->width = width;
+	image->height = height;
+	image->texels.resize(4 * count);
+	// bit 5 of the descriptor marks images stored from the top
+	const bool topDown = header[17] & 0x20;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x) {
+			const uint8_t *source = &bgra[bytes * (static_cast<size_t>(topDown ? height - 1 - y : y) * width + x)];
+			uint8_t *texel = &image->texels[4 * (static_cast<size_t>(y) * width + x)];
+			texel[0] = source[2];
+			texel[1] = source[1];
+			texel[2] = source[0];
+			texel[3] = bytes == 4 ? source[3] : 255;
+		}
+	return true;
+}
+
+// Bilinear resize to a size² square
+static std::vector<uint8_t> ResizeImage(const Image &image, int size) {
+	if (image.width == size && image.height == size) return image.texels;
+	std::vector<uint8_t> texels(4 * static_cast<size_t>(size) * size);
+	for (int y = 0; y < size; ++y) {
+		const float sy = std::clamp((y + 0.5f) * image.height / size - 0.5f, 0.0f, static_cast<float>(image.height - 1));
+		const int y0 = static_cast<int>(sy), y1 = std::min(y0 + 1, image.height - 1);
+		const float fy = sy - y0;
+		for (int x = 0; x < size; ++x) {
+			const float sx = std::clamp((x + 0.5f) * image.width / size - 0.5f, 0.0f, static_cast<float>(image.width - 1));
+			const int x0 = static_cast<int>(sx), x1 = std::min(x0 + 1, image.width - 1);
+			const float fx = sx - x0;
+			auto texel = [&](int tx, int ty, int c) { return static_cast<float>(image.texels[4 * (static_cast<size_t>(ty) * image.width + tx) + c]); };
+			for (int c = 0; c < 4; ++c) {
+				const float top = texel(x0, y1, c) + (texel(x1, y1, c) - texel(x0, y1, c)) * fx;
+				const float bottom = texel(x0, y0, c) + (texel(x1, y0, c) - texel(x0, y0, c)) * fx;
+				texels[4 * (static_cast<size_t>(y) * size + x) + c] = static_cast<uint8_t>(std::lround(bottom + (top - bottom) * fy));
+			}
+		}
+	}
+	return texels;
+}
+
+// A texture resized to its bucket's size, white if the file could not be decoded
+struct TextureImage {
+	std::string path;
+	int bucket = 0, layer = 0;
+	std::vector<uint8_t> texels;
+};
+
+// The textures of a scene. Ids are handed out while the materials are parsed, from the image headers only,
+// the images are decoded afterwards.
+class TextureLibrary {
+public:
+	// Id of the texture at path, adding it on first use. -1 if it isn't a readable image.
+	int Add(const std::string &path) {
+		const auto [it, inserted] = ids.try_emplace(path, -1);
+		if (!inserted) return it->second;
+		int width, height;
+		if (!ReadImage(path.c_str(), width, height, nullptr)) return -1;
+		const int bucket = TextureBucket(width, height);
+		images.push_back({path, bucket, layerCounts[bucket]++, {}});
+		return it->second = TextureId(bucket, images.back().layer);
+	}
+
+	void Load() {
+		for (TextureImage &texture : images)
+			Decode(texture);
+	}
+
+	// Decodes the image into the texture's bucket size, even if the file has been resized since
+	static void Decode(TextureImage &texture) {
+		const int size = TEXTURE_MIN_SIZE << texture.bucket;
+		Image image;
+		int width, height;
+		if (ReadImage(texture.path.c_str(), width, height, &image))
+			texture.texels = ResizeImage(image, size);
+		else
+			texture.texels.assign(4 * static_cast<size_t>(size) * size, 255);
+	}
+
+	std::array<int, TEXTURE_BUCKET_COUNT> layerCounts{};
+	std::vector<TextureImage> images;
+
+private:
+	std::map<std::string, int> ids;
+};
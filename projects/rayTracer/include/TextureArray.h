@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "glad/glad.h"
+#include "Texture.h"
+
+// One mipmapped RGBA8 texture array per texture bucket, bound to consecutive texture units starting at firstUnit
+class TextureArrays {
+public:
+	explicit TextureArrays(int firstUnit) : firstUnit(firstUnit) {
+		Upload(TextureLibrary{});
+	}
+
+	~TextureArrays() {
+		glDeleteTextures(TEXTURE_BUCKET_COUNT, handles);
+	}
+
+	TextureArrays(const TextureArrays&) = delete;
+	TextureArrays& operator=(const TextureArrays&) = delete;
+
+	// Replaces every bucket with the library's textures. Empty buckets get a single texel so the samplers stay complete.
+	void Upload(const TextureLibrary &library) {
+		glDeleteTextures(TEXTURE_BUCKET_COUNT, handles);
+		glGenTextures(TEXTURE_BUCKET_COUNT, handles);
+		for (int bucket = 0; bucket < TEXTURE_BUCKET_COUNT; ++bucket) {
+			const int layers = library.layerCounts[bucket];
+			const int size = layers > 0 ? TEXTURE_MIN_SIZE << bucket : 1;
+			glActiveTexture(GL_TEXTURE0 + firstUnit + bucket);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, handles[bucket]);
+			glTexStorage3D(GL_TEXTURE_2D_ARRAY, std::bit_width(static_cast<unsigned>(size)), GL_RGBA8, size, size, std::max(layers, 1));
+			for (const TextureImage &image : library.images)
+				if (image.bucket == bucket)
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, image.layer, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.texels.data());
+			if (layers > 0) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// Replaces a single layer of an uploaded library and rebuilds its bucket's mipmaps
+	void UploadImage(const TextureImage &image) const {
+		const int size = TEXTURE_MIN_SIZE << image.bucket;
+		glActiveTexture(GL_TEXTURE0 + firstUnit + image.bucket);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, handles[image.bucket]);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, image.layer, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.texels.data());
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// Texture units the shader's sampler array reads from
+	[[nodiscard]] std::array<GLint, TEXTURE_BUCKET_COUNT> Units() const {
+		std::array<GLint, TEXTURE_BUCKET_COUNT> units{};
+		for (int bucket = 0; bucket < TEXTURE_BUCKET_COUNT; ++bucket)
+			units[bucket] = firstUnit + bucket;
+		return units;
+	}
+
+private:
+	const int firstUnit;
+	GLuint handles[TEXTURE_BUCKET_COUNT]{};
+};
@@ -0,0 +1,188 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "glad/glad.h"
+#include "ComputeFrame.h"
+#include "MaterialFeatures.h"
+#include "ShaderProgram.h"
+#include "SSBO.h"
+
+// Tiled compute rendering: a fixed number of persistent work groups each take the next tile off a shared queue
+// until it runs dry, so the work is spread by whoever is free instead of by the rasterizer.
+// Must match tiled.comp.
+constexpr int TILE_SIZE = 8;
+// Enough groups to fill any current GPU, the rest of the tiles are pulled by whichever group finishes first
+constexpr GLuint TILED_PERSISTENT_GROUPS = 256;
+// Each pixel's sample count and the sums of its samples' luminance and squared luminance
+constexpr size_t PIXEL_STATS_SIZE = 16;
+// The queue's head, its length and the tiles still tracing, padded to 16 bytes
+constexpr size_t TILE_HEADER_SIZE = 16;
+
+// Adaptive sampling: every tile gets a sample budget from the noise left in its pixels. Pixels whose relative
+// standard error is below errorTarget, or that took sampleLimit samples, stop tracing. Once no tile is left the
+// renderer stops until the accumulation restarts.
+struct AdaptiveSampling {
+	bool enabled = false;
+	float errorTarget = 0.02f;
+	int sampleLimit = 4096;
+};
+
+// Spreads the low 16 bits of v to the even bits
+constexpr uint32_t SpreadBits(uint32_t v) {
+	v &= 0xFFFF;
+	v = (v | v << 8) & 0x00FF00FF;
+	v = (v | v << 4) & 0x0F0F0F0F;
+	v = (v | v << 2) & 0x33333333;
+	v = (v | v << 1) & 0x55555555;
+	return v;
+}
+
+// Every tile of the image packed as x | y << 16, in Morton order so neighbouring groups trace neighbouring tiles
+static std::vector<uint32_t> MortonTiles(glm::ivec2 tileCount) {
+	std::vector<uint32_t> tiles;
+	tiles.reserve(static_cast<size_t>(tileCount.x) * tileCount.y);
+	for (uint32_t y = 0; y < static_cast<uint32_t>(tileCount.y); ++y)
+		for (uint32_t x = 0; x < static_cast<uint32_t>(tileCount.x); ++x)
+			tiles.push_back(x | y << 16);
+	auto morton = [](uint32_t tile) { return SpreadBits(tile) | SpreadBits(tile >> 16) << 1; };
+	std::ranges::sort(tiles, {}, morton);
+	return tiles;
+}
+
+class TiledRenderer {
+public:
+	TiledRenderer(std::vector<const char*> paths, unsigned materialFeatures)
+		: paths(std::move(paths)), materialFeatures(materialFeatures), tileBuffer(15), pixelStatsBuffer(18)
+	{
+		glGenBuffers(1, &readbackBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint32_t), nullptr, GL_STREAM_READ);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		Rebuild();
+		build->Poll(true);
+		const bool built = SwapBuiltPrograms();
+		assert(built);
+	}
+
+	~TiledRenderer() {
+		glDeleteProgram(program);
+		if (readbackFence) glDeleteSync(readbackFence);
+		glDeleteBuffers(1, &readbackBuffer);
+	}
+
+	TiledRenderer(const TiledRenderer&) = delete;
+	TiledRenderer& operator=(const TiledRenderer&) = delete;
+
+	// The sources of the program, for watching them
+	[[nodiscard]] const std::vector<const char*>& Paths() const { return paths; }
+
+	// Starts building the program again in the background, the running one keeps tracing until it linked
+	void Rebuild() {
+		build = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_COMPUTE_SHADER, paths, MaterialFeatureDefines(materialFeatures)}},
+			PermutationCachePath("resources/cache/tiled.rtprogram", materialFeatures));
+	}
+
+	// Rebuilds the program for the material features the scene uses now, if they changed
+	void SetMaterialFeatures(unsigned features) {
+		if (features == materialFeatures) return;
+		materialFeatures = features;
+		Rebuild();
+	}
+
+	// Swaps the rebuilt program in once it is done, keeping the running one if it failed.
+	// Returns true if the program was swapped.
+	bool SwapBuiltPrograms() {
+		if (!build) return false;
+		const ProgramStatus status = build->Poll();
+		if (status == ProgramStatus::PENDING) return false;
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(program);
+			program = build->Take();
+		}
+		else std::cout << "Failed to build the tiled shader, keeping the previous one:\n" << build->Log() << std::endl;
+		build.reset();
+		return status == ProgramStatus::READY;
+	}
+
+	// Traces raysPerPixel samples per pixel of every tile and adds their sum and count like the fragment shader does.
+	// With adaptive sampling the tiles' budgets follow their noise instead and converged pixels are left alone.
+	void Render(GLuint image, glm::ivec2 imageSize, const ComputeFrame &frame, const AdaptiveSampling &adaptive) {
+		// the first frame starts the pixels' statistics over, a count still on its way is from before
+		if (frame.frameCount <= 1) {
+			activeTiles = UINT32_MAX;
+			if (readbackFence) glDeleteSync(readbackFence);
+			readbackFence = nullptr;
+		}
+		else PollActiveTiles();
+		if (adaptive.enabled && activeTiles == 0)
+			return;
+
+		const glm::ivec2 tileCount = (imageSize + TILE_SIZE - 1) / TILE_SIZE;
+		const GLuint tiles = static_cast<GLuint>(tileCount.x) * static_cast<GLuint>(tileCount.y);
+		const uint32_t header[TILE_HEADER_SIZE / sizeof(uint32_t)] = {0, tiles, 0, 0};
+		if (tileCount != tiledSize) {
+			const std::vector<uint32_t> mortonTiles = MortonTiles(tileCount);
+			std::vector<uint32_t> data(std::begin(header), std::end(header));
+			data.insert(data.end(), mortonTiles.begin(), mortonTiles.end());
+			tileBuffer.BufferData(data.data(), data.size() * sizeof(uint32_t));
+			const std::vector<std::byte> stats(static_cast<size_t>(imageSize.x) * imageSize.y * PIXEL_STATS_SIZE);
+			pixelStatsBuffer.BufferData(stats.data(), stats.size());
+			tiledSize = tileCount;
+		}
+		else tileBuffer.BufferSubData(0, header, sizeof(header));
+
+		SetFrameUniforms(program, frame, imageSize);
+		glProgramUniform1i(program, glGetUniformLocation(program, "AdaptiveSampling"), adaptive.enabled);
+		glProgramUniform1f(program, glGetUniformLocation(program, "ErrorTarget"), adaptive.errorTarget);
+		glProgramUniform1ui(program, glGetUniformLocation(program, "SampleLimit"), static_cast<GLuint>(std::max(adaptive.sampleLimit, 1)));
+		glBindImageTexture(0, image, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glUseProgram(program);
+		glDispatchCompute(std::min(tiles, TILED_PERSISTENT_GROUPS), 1, 1);
+		glUseProgram(0);
+		// the next frame resets the queue's head the shader counted up
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		// the count is copied aside and read a frame or more later, so the CPU never waits for the GPU
+		if (adaptive.enabled && !readbackFence) {
+			glBindBuffer(GL_COPY_READ_BUFFER, tileBuffer.Handle());
+			glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 2 * sizeof(uint32_t), 0, sizeof(uint32_t));
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	// Tiles that still had pixels to trace in the last adaptive frame read back, 0 once the image converged
+	[[nodiscard]] uint32_t ActiveTiles() const { return activeTiles; }
+
+private:
+	// Takes the count of the frame copied aside last, once the GPU got there
+	void PollActiveTiles() {
+		if (!readbackFence || glClientWaitSync(readbackFence, 0, 0) == GL_TIMEOUT_EXPIRED) return;
+		glDeleteSync(readbackFence);
+		readbackFence = nullptr;
+		glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(activeTiles), &activeTiles);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	const std::vector<const char*> paths;
+	unsigned materialFeatures;
+	GLuint program = 0;
+	std::unique_ptr<ProgramBuild> build;
+
+	SSBO tileBuffer;
+	SSBO pixelStatsBuffer;
+	glm::ivec2 tiledSize{0};
+	uint32_t activeTiles = UINT32_MAX;
+	GLuint readbackBuffer = 0;
+	GLsync readbackFence = nullptr;
+};
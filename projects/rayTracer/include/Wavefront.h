@@ -0,0 +1,212 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glad/glad.h"
+#include "ComputeFrame.h"
+#include "ShaderProgram.h"
+#include "ShaderStructs.h"
+#include "SSBO.h"
+
+// Wavefront path tracing: instead of one shader following every path to its end, paths are advanced a stage at
+// a time by compute shaders that each do one kind of work, connected through queues of path indices.
+// Must match wavefront.glsl.
+constexpr GLuint WAVEFRONT_GROUP_SIZE = 64;
+// Paths traced at once, larger images are traced in several waves. Bounds the path state to 64 MiB, 108 MiB
+// with the shadow rays and queues.
+constexpr GLuint WAVEFRONT_PATH_CAPACITY = 1 << 19;
+// std430 sizes: PathState is six vec3 and float rows, four scalars and a vec3 and uint row. ShadowRay is three
+// rows and the distance, padded to its 16 byte alignment.
+constexpr size_t PATH_STATE_SIZE = 8 * 16;
+constexpr size_t SHADOW_RAY_SIZE = 4 * 16;
+constexpr size_t QUEUE_COUNTER_SIZE = 16;
+
+enum WavefrontQueue : GLuint {
+	EXTEND_QUEUE_A,
+	EXTEND_QUEUE_B,
+	DIFFUSE_QUEUE,
+	SPECULAR_QUEUE,
+	REFRACT_QUEUE,
+	SHADOW_QUEUE,
+	QUEUE_COUNT
+};
+
+enum WavefrontStage {
+	GENERATE_STAGE,
+	QUEUE_STAGE,
+	EXTEND_STAGE,
+	DIFFUSE_STAGE,
+	SPECULAR_STAGE,
+	REFRACT_STAGE,
+	SHADOW_STAGE,
+	ACCUMULATE_STAGE,
+	WAVEFRONT_STAGE_COUNT
+};
+
+constexpr const char *wavefrontStageNames[WAVEFRONT_STAGE_COUNT] = {
+	"generate", "queue", "extend", "diffuse", "specular", "refract", "shadow", "accumulate"
+};
+
+class WavefrontRenderer {
+public:
+	// sharedPaths are the sources every stage is built from, each stage's own shader is appended to them
+	explicit WavefrontRenderer(std::vector<const char*> sharedPaths) : sharedPaths(std::move(sharedPaths)),
+		pathBuffer(11), queueCounterBuffer(12), queueBuffer(13), shadowRayBuffer(14)
+	{
+		pathBuffer.BufferData(nullptr, WAVEFRONT_PATH_CAPACITY * PATH_STATE_SIZE);
+		queueCounterBuffer.BufferData(nullptr, QUEUE_COUNT * QUEUE_COUNTER_SIZE);
+		queueBuffer.BufferData(nullptr, QUEUE_COUNT * WAVEFRONT_PATH_CAPACITY * sizeof(GLuint));
+		shadowRayBuffer.BufferData(nullptr, WAVEFRONT_PATH_CAPACITY * SHADOW_RAY_SIZE);
+
+		Rebuild();
+		for (auto &build : builds)
+			build->Poll(true);
+		const bool built = SwapBuiltPrograms();
+		assert(built);
+	}
+
+	~WavefrontRenderer() {
+		for (const GLuint program : programs)
+			glDeleteProgram(program);
+	}
+
+	WavefrontRenderer(const WavefrontRenderer&) = delete;
+	WavefrontRenderer& operator=(const WavefrontRenderer&) = delete;
+
+	// The sources of a stage, for watching them
+	[[nodiscard]] std::vector<const char*> StagePaths(int stage) const {
+		std::vector<const char*> paths = sharedPaths;
+		paths.push_back(stagePaths[stage].c_str());
+		return paths;
+	}
+
+	// Starts building every stage again in the background, the running ones keep tracing until all of them linked
+	void Rebuild() {
+		for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage)
+			builds[stage] = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_COMPUTE_SHADER, StagePaths(stage), {}}},
+				"resources/cache/wavefront_" + std::string(wavefrontStageNames[stage]) + ".rtprogram");
+	}
+
+	// Swaps the rebuilt stages in together once each of them is done, the path layout they share may have changed.
+	// If any of them failed the running ones are kept. Returns true if the stages were swapped.
+	bool SwapBuiltPrograms() {
+		if (!builds[0]) return false;
+		for (auto &build : builds)
+			if (build->Poll() == ProgramStatus::PENDING) return false;
+
+		bool failed = false;
+		for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage)
+			if (builds[stage]->Poll() == ProgramStatus::FAILED) {
+				std::cout << "Failed to build the wavefront " << wavefrontStageNames[stage] << " stage:\n" << builds[stage]->Log() << std::endl;
+				failed = true;
+			}
+		if (!failed)
+			for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage) {
+				glDeleteProgram(programs[stage]);
+				programs[stage] = builds[stage]->Take();
+			}
+		for (auto &build : builds)
+			build.reset();
+		return !failed;
+	}
+
+	// Traces raysPerPixel paths per pixel of the image and adds their sum and count to it like the fragment shader does
+	void Render(GLuint image, glm::ivec2 imageSize, const ComputeFrame &frame) {
+		for (const GLuint program : programs) {
+			SetFrameUniforms(program, frame, imageSize);
+			glProgramUniform1ui(program, glGetUniformLocation(program, "PathCapacity"), WAVEFRONT_PATH_CAPACITY);
+		}
+		glBindImageTexture(0, image, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queueCounterBuffer.Handle());
+
+		constexpr GLuint allQueues = (1u << QUEUE_COUNT) - 1;
+		constexpr GLuint shadingQueues = 1u << DIFFUSE_QUEUE | 1u << SPECULAR_QUEUE | 1u << REFRACT_QUEUE | 1u << SHADOW_QUEUE;
+		const GLuint pixelCount = static_cast<GLuint>(imageSize.x) * static_cast<GLuint>(imageSize.y);
+		for (GLuint firstPixel = 0; firstPixel < pixelCount; firstPixel += WAVEFRONT_PATH_CAPACITY) {
+			const GLuint pathCount = std::min(WAVEFRONT_PATH_CAPACITY, pixelCount - firstPixel);
+			const GLuint pathGroups = (pathCount + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+			for (const GLuint program : programs) {
+				glProgramUniform1ui(program, glGetUniformLocation(program, "FirstPixel"), firstPixel);
+				glProgramUniform1ui(program, glGetUniformLocation(program, "PathCount"), pathCount);
+			}
+
+			for (int sample = 0; sample < frame.raysPerPixel; ++sample) {
+				int extendQueue = EXTEND_QUEUE_A;
+				PrepareQueues(allQueues);
+				SetStageUniform(GENERATE_STAGE, "Sample", sample);
+				SetStageUniform(GENERATE_STAGE, "ExtendQueue", extendQueue);
+				Dispatch(GENERATE_STAGE, pathGroups);
+
+				for (int bounce = 0; bounce < frame.rayCapacity; ++bounce) {
+					const int nextQueue = extendQueue ^ 1;
+					// everything filled during this bounce starts out empty
+					PrepareQueues(shadingQueues | 1u << nextQueue);
+					SetStageUniform(EXTEND_STAGE, "ExtendQueue", extendQueue);
+					DispatchQueue(EXTEND_STAGE, extendQueue);
+
+					PrepareQueues(0);
+					for (const int stage : {DIFFUSE_STAGE, SPECULAR_STAGE, REFRACT_STAGE})
+						SetStageUniform(stage, "ExtendQueue", nextQueue);
+					DispatchQueue(DIFFUSE_STAGE, DIFFUSE_QUEUE);
+					DispatchQueue(SPECULAR_STAGE, SPECULAR_QUEUE);
+					DispatchQueue(REFRACT_STAGE, REFRACT_QUEUE);
+
+					PrepareQueues(0);
+					DispatchQueue(SHADOW_STAGE, SHADOW_QUEUE);
+					extendQueue = nextQueue;
+				}
+
+				SetStageUniform(ACCUMULATE_STAGE, "LastSample", sample == frame.raysPerPixel - 1);
+				Dispatch(ACCUMULATE_STAGE, pathGroups);
+			}
+		}
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+		glUseProgram(0);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+private:
+	// For the int and bool uniforms of a single stage
+	void SetStageUniform(int stage, const char *name, int value) const {
+		glProgramUniform1i(programs[stage], glGetUniformLocation(programs[stage], name), value);
+	}
+
+	void Dispatch(int stage, GLuint groups) const {
+		glUseProgram(programs[stage]);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+
+	// Runs a stage over a queue, with as many groups as the last PrepareQueues counted
+	void DispatchQueue(int stage, GLuint queue) const {
+		glUseProgram(programs[stage]);
+		glDispatchComputeIndirect(static_cast<GLintptr>(queue * QUEUE_COUNTER_SIZE + sizeof(GLuint)));
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+
+	// Empties the queues in resetQueues and writes the dispatch arguments of all of them
+	void PrepareQueues(GLuint resetQueues) const {
+		glProgramUniform1ui(programs[QUEUE_STAGE], glGetUniformLocation(programs[QUEUE_STAGE], "ResetQueues"), resetQueues);
+		Dispatch(QUEUE_STAGE, 1);
+	}
+
+	const std::vector<const char*> sharedPaths;
+	const std::array<std::string, WAVEFRONT_STAGE_COUNT> stagePaths = [] {
+		std::array<std::string, WAVEFRONT_STAGE_COUNT> paths;
+		for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage)
+			paths[stage] = "resources/shaders/wavefront/" + std::string(wavefrontStageNames[stage]) + ".comp";
+		return paths;
+	}();
+	std::array<GLuint, WAVEFRONT_STAGE_COUNT> programs{};
+	std::array<std::unique_ptr<ProgramBuild>, WAVEFRONT_STAGE_COUNT> builds;
+
+	SSBO pathBuffer;
+	SSBO queueCounterBuffer;
+	SSBO queueBuffer;
+	SSBO shadowRayBuffer;
+};
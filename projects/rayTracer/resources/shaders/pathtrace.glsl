@@ -0,0 +1,160 @@
+
+// --- Path tracing ---
+vec3 CastRay(Ray ray)
+{
+	vec3 incomingLight = vec3(0);
+	vec3 rayColor = vec3(1);
+	// pdf of the last bounce's direction, 0 after bounces that don't sample lights directly.
+	// Where that bounce was and its normal, the light tree picked lights for them.
+	float scatterPdf = 0.0f;
+	vec3 scatterOrigin = vec3(0);
+	vec3 scatterNormal = vec3(0);
+	for (int bounceIndex = 0; bounceIndex < RayCapacity; ++bounceIndex)
+	{
+		SampleBounce = uint(bounceIndex);
+		HitInfo hitinfo = CollisionDetection(ray);
+		if (!hitinfo.didHit){
+			// the environment lights the rays that escape, weighed against sampling it directly
+			if (EnvironmentSize.x > 0)
+			{
+				incomingLight += EnvironmentRadiance(ray.direction) * rayColor * ScatterWeight(scatterPdf, EnvironmentDirectPdf(ray.direction));
+			}
+			break;
+		}
+
+		// materials may still be streaming in while the scene loads
+		if (hitinfo.materialIndex >= materials.length()) break;
+
+		// move ray to new position, the cone grows with the distance travelled
+		ray.coneWidth += ray.coneSpread * hitinfo.dst;
+		ray.origin = hitinfo.hitPoint;
+		ray.origin += 0.00001f * ray.direction;
+
+		// extract material
+		Material material = SurfaceMaterial(hitinfo, ray);
+
+		// lighting, weighed against sampling the surface directly if the last bounce did
+		vec3 emittedLight = material.emissionColor * material.strength;
+		float lightPdf = scatterPdf != 0.0f ? EmissivePdf(scatterOrigin, scatterNormal, hitinfo.hitPoint, hitinfo.dst, -dot(ray.direction, hitinfo.normal)) : 0.0f;
+		incomingLight += emittedLight * rayColor * ScatterWeight(scatterPdf, lightPdf);
+
+		vec3 normal = hitinfo.normal;
+		vec3 fresnel = SurfaceFresnel(material.albedo, material.metallic, ray.direction, normal);
+#if TRANSPARENT_MATERIALS
+		bool isTransparent = material.ior != 0.0f;
+		bool isExit = ray.ior != 1.0f;
+#else
+		// rays never enter anything
+		const bool isTransparent = false;
+		const bool isExit = false;
+#endif
+
+		// determine next ray's bounce type (refract, diffuse or specular)
+#if METALLIC_MATERIALS
+		bool isSpecularBounce = material.metallic > Sample1D(SAMPLE_BOUNCE_TYPE);
+#else
+		const bool isSpecularBounce = false;
+#endif
+
+		// cast specular light
+		if (isSpecularBounce){
+			rayColor *= fresnel;
+			bool isGlossy = material.roughness >= GLOSSY_MIN_ROUGHNESS;
+
+			// sample a light directly from glossy surfaces, weighed against the reflection finding it
+			if (isGlossy)
+			{
+				LightSample light = SampleDirectLight(ray.origin, normal);
+				float bsdfPdf;
+				float bsdf = EvaluateSpecular(ray.direction, light.direction, normal, material.roughness, bsdfPdf);
+				if (bsdf > 0.0f && light.pdf > 0.0f)
+				{
+					Ray shadowRay = ray;
+					shadowRay.direction = light.direction;
+					if (Unoccluded(shadowRay, light.dst))
+						incomingLight += light.radiance * rayColor * bsdf / light.pdf * PowerHeuristic(light.pdf, bsdfPdf);
+				}
+			}
+
+			vec3 incident = ray.direction;
+			float weight;
+			ray.direction = SampleSpecular(ray.direction, normal, material.roughness, weight);
+			ray.coneSpread += material.roughness * material.roughness;
+			rayColor *= weight;
+			scatterPdf = 0.0f;
+			if (isGlossy && weight > 0.0f)
+				EvaluateSpecular(incident, ray.direction, normal, material.roughness, scatterPdf);
+			scatterOrigin = ray.origin;
+			scatterNormal = normal;
+		}
+		else
+		{
+			// --- diffused light ---
+			// determine refaction
+			float ior = mix(1.0f, material.ior, isTransparent && !isExit);
+			vec3 refractedDir = refract(ray.direction, normal, ray.ior / ior);
+
+			if (!isExit){
+				rayColor *= mix(material.albedo, vec3(0), material.metallic);
+			}
+			rayColor *= (1.0f - fresnel);
+
+			// sample a light directly from diffuse surfaces, or take the one resampled for the pixel
+			bool resampled = false;
+			if (!isTransparent)
+			{
+				LightSample light = DiffuseDirectLight(ray.origin, normal, resampled);
+				float cosine = dot(light.direction, normal);
+				if (cosine > 0.0f && light.pdf > 0.0f)
+				{
+					Ray shadowRay = ray;
+					shadowRay.direction = light.direction;
+					if (Unoccluded(shadowRay, light.dst))
+					{
+						// the diffuse lobe is cosine/pi, the albedo is already in rayColor
+						float bsdfPdf = cosine / Pi;
+						incomingLight += light.radiance * rayColor * bsdfPdf / light.pdf * (resampled ? 1.0f : PowerHeuristic(light.pdf, bsdfPdf));
+					}
+				}
+			}
+
+			ray.direction = isTransparent ? refractedDir : SampleCosineHemisphere(normal, Sample2D(SAMPLE_SCATTER));
+			// diffuse bounces scatter over the hemisphere, the geometry they see only needs to be roughly right
+			ray.coneSpread += isTransparent ? 0.0f : 1.0f;
+			scatterPdf = isTransparent ? 0.0f : resampled ? RESAMPLED_SCATTER_PDF : max(dot(ray.direction, normal), 0.0f) / Pi;
+			scatterOrigin = ray.origin;
+			scatterNormal = normal;
+			ray.ior = ior;
+		}
+		// Random early exit if ray colour is nearly 0 (can't contribute much to final result)
+		float p = max(rayColor.r, max(rayColor.g, rayColor.b));
+		if (Sample1D(SAMPLE_ROULETTE) >= p) {
+			break;
+		}
+		rayColor *= 1.0f / p;
+	}
+	return incomingLight;
+}
+
+// Sums NumRaysPerPixel paths through the pixel at texCoord, leaving out the ones that were deferred.
+// The frames so far took the pixel's earlier samples.
+vec3 TracePixel(uvec2 pixel, vec2 texCoord, float pixelSpread, out int completedRays)
+{
+	vec3 totalIncomingLight = vec3(0);
+	completedRays = 0;
+	for (int rayIndex = 0; rayIndex < NumRaysPerPixel; rayIndex++)
+	{
+		InitSampler(pixel, (FrameCount - 1u) * uint(NumRaysPerPixel) + uint(rayIndex));
+		Ray ray = CameraRay(texCoord, pixelSpread);
+
+		// Cast Ray
+		sampleDeferred = false;
+		vec3 incomingLight = CastRay(ray);
+		if (!sampleDeferred)
+		{
+			totalIncomingLight += incomingLight;
+			completedRays++;
+		}
+	}
+	return totalIncomingLight;
+}
@@ -1,48 +1,139 @@
 // random
 const float Pi = 3.1416f;
 uniform uint FrameCount;
-uint RandSeed;
-// Random sequence generator
-uint LCG(inout uint prev)
+
+// --- Sampler ---
+// Low discrepancy samples from Owen scrambled Sobol points, following Burley's "Practical Hash-based Owen
+// Scrambling". Every dimension is a 2D Sobol sequence with its own shuffle and scramble, seeded by the pixel,
+// so dimensions can be drawn in any order without correlating. A sample's dimensions are laid out per bounce.
+#define SAMPLE_CAMERA 0u
+#define SAMPLE_BOUNCE_TYPE 1u
+#define SAMPLE_LIGHT_PICK 2u
+#define SAMPLE_LIGHT 3u
+#define SAMPLE_LIGHT_JITTER 4u
+#define SAMPLE_SCATTER 5u
+#define SAMPLE_ROULETTE 6u
+#define SAMPLE_DIMENSIONS_PER_BOUNCE 7u
+
+uint SamplerSeed;
+uvec2 SamplerPixel;
+uint SampleIndex;
+uint SampleBounce;
+
+// PCG hash
+uint Hash(uint x)
+{
+	uint state = x * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Starts the sampleIndex-th sample of the pixel at its first bounce
+void InitSampler(uvec2 pixel, uint sampleIndex)
+{
+	SamplerSeed = Hash(pixel.x ^ Hash(pixel.y));
+	SamplerPixel = pixel;
+	SampleIndex = sampleIndex;
+	SampleBounce = 0u;
+}
+
+// Permutes x so that every bit only depends on the bits below it
+uint LaineKarrasPermutation(uint x, uint seed)
 {
-    const uint LCG_A = 1664525u;
-    const uint LCG_C = 1013904223u;
-    prev = (LCG_A * prev + LCG_C);
-    return prev & 0x00FFFFFFu;
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
 }
 
-void InitRandomSeed()
+// Owen scrambling of a binary fraction, every bit is flipped depending on the bits above it
+uint NestedUniformScramble(uint x, uint seed)
 {
-    uint seedTime = FrameCount;
-    uint seedX = uint(gl_FragCoord.x);
-    uint seedY = uint(gl_FragCoord.y);
-    RandSeed = LCG(seedX) ^ LCG(seedY) ^ LCG(seedTime);
+	return bitfieldReverse(LaineKarrasPermutation(bitfieldReverse(x), seed));
 }
 
-uint NextRandom()
+// The second Sobol dimension, the first one is the index's bits reversed
+uint SobolSecondDimension(uint index)
 {
-    RandSeed = RandSeed * 747796405u + 2891336453u;
-    uint result = ((RandSeed >> ((RandSeed >> 28) + 4u)) ^ RandSeed) * 277803737u;
-    result = (result >> 22) ^ result;
-    return result;
+	uint result = 0u;
+	for (uint v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1)
+		if ((index & 1u) != 0u)
+			result ^= v;
+	return result;
 }
 
-float RandomValue()
+// The seed of a dimension of the current bounce
+uint DimensionSeed(uint dimension)
 {
-    return NextRandom() / 4294967295.0; // 2^32 - 1
+	return Hash(SamplerSeed ^ Hash(SampleBounce * SAMPLE_DIMENSIONS_PER_BOUNCE + dimension));
 }
-// Random value in normal distribution (with mean=0 and sd=1)
-float RandomValueNormalDistribution()
+
+// [0, 1) from a 32 bit fraction, 24 bits keep it below 1 as a float
+float FractionToFloat(uint x)
 {
-    float theta = 2.0f * Pi * RandomValue();
-    float rho = sqrt(-2 * log(RandomValue()));
-    return rho * cos(theta);
+	return float(x >> 8) / 16777216.0f;
 }
-// Calculate a random direction
-vec3 GetRandomDirection()
+
+vec2 Sample2D(uint dimension)
+{
+	uint seed = DimensionSeed(dimension);
+	uint index = NestedUniformScramble(SampleIndex, seed);
+	uint x = NestedUniformScramble(bitfieldReverse(index), Hash(seed ^ 0x9e3779b9u));
+	uint y = NestedUniformScramble(SobolSecondDimension(index), Hash(seed ^ 0x7f4a7c15u));
+	return vec2(FractionToFloat(x), FractionToFloat(y));
+}
+
+float Sample1D(uint dimension)
 {
-    float x = RandomValueNormalDistribution();
-    float y = RandomValueNormalDistribution();
-    float z = RandomValueNormalDistribution();
-    return normalize(vec3(x, y , z));
-}
\ No newline at end of file
+	uint seed = DimensionSeed(dimension);
+	uint index = NestedUniformScramble(SampleIndex, seed);
+	return FractionToFloat(NestedUniformScramble(bitfieldReverse(index), Hash(seed ^ 0x9e3779b9u)));
+}
+
+// Tangent and bitangent completing the unit vector n to an orthonormal basis (Duff et al.)
+void OrthonormalBasis(vec3 n, out vec3 tangent, out vec3 bitangent)
+{
+	float s = n.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (s + n.z);
+	float b = n.x * n.y * a;
+	tangent = vec3(1.0f + s * n.x * n.x * a, s * b, -s * n.x);
+	bitangent = vec3(b, s + n.y * n.y * a, -n.y);
+}
+
+// A direction from a uniform point u
+vec3 SampleSphere(vec2 u)
+{
+	float z = 1.0f - 2.0f * u.x;
+	float r = sqrt(max(1.0f - z * z, 0.0f));
+	float phi = 2.0f * Pi * u.y;
+	return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+// A direction around the normal with pdf cos(theta)/pi
+vec3 SampleCosineHemisphere(vec3 normal, vec2 u)
+{
+	vec3 tangent, bitangent;
+	OrthonormalBasis(normal, tangent, bitangent);
+	float r = sqrt(u.x);
+	float phi = 2.0f * Pi * u.y;
+	return normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(max(1.0f - u.x, 0.0f)));
+}
+
+// A microfacet normal of the GGX distribution of roughness alpha around the normal, picked among the ones visible
+// from view, which points away from the surface (Dupuy and Benyoub, "Sampling Visible GGX Normals with Spherical
+// Caps"). Its pdf is G1(view) * max(dot(view, h), 0) * D(h) / dot(view, normal).
+vec3 SampleGGXVisible(vec3 normal, vec3 view, float alpha, vec2 u)
+{
+	vec3 tangent, bitangent;
+	OrthonormalBasis(normal, tangent, bitangent);
+	// stretched by alpha the microfacets form a unit hemisphere, whose visible normals are a uniformly sampled
+	// spherical cap offset by the view
+	vec3 stretched = normalize(vec3(alpha * dot(view, tangent), alpha * dot(view, bitangent), dot(view, normal)));
+	float phi = 2.0f * Pi * u.x;
+	float z = (1.0f - u.y) * (1.0f + stretched.z) - stretched.z;
+	float sinTheta = sqrt(clamp(1.0f - z * z, 0.0f, 1.0f));
+	vec3 h = vec3(sinTheta * cos(phi), sinTheta * sin(phi), z) + stretched;
+	return normalize(tangent * (alpha * h.x) + bitangent * (alpha * h.y) + normal * max(h.z, 0.0f));
+}
@@ -5,9 +5,11 @@ in vec2 TexCoord;
 out vec4 FragColor;
 
 //Uniforms
+// the accumulated sum of the samples in rgb and their count in alpha
 uniform sampler2D SourceTexture;
 
 void main()
 {
-	FragColor = texture(SourceTexture, TexCoord);
+	vec4 accumulation = texture(SourceTexture, TexCoord);
+	FragColor = vec4(accumulation.rgb / max(accumulation.a, 1.0f), 1.0f);
 }
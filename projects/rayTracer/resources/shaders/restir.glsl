@@ -0,0 +1,116 @@
+
+// --- Resampled direct lighting ---
+// ReSTIR DI (Bitterli et al., "Spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct
+// lighting"). Every pixel keeps a reservoir with one light sample for its first hit, picked among many candidates
+// in proportion to what it would add there without shadows. The resampling passes draw the candidates and reuse
+// the pixel's reservoir of the frames before and its neighbours', the path tracers light their first bounce with
+// what is left. Must match ResampledLighting.h.
+struct Reservoir
+{
+	vec3 lightPoint; float weightSum; // the direction for the environment
+	vec3 lightNormal; float sampleCount; // 0 for the environment
+	vec3 radiance; float contributionWeight; // estimates one over the sample's density over area, 0 if it's shadowed
+};
+
+layout(std430, binding = 19) buffer ReservoirBuffer {
+	// every pixel's reservoir after reusing the previous frames, then after reusing the neighbours'
+	Reservoir reservoirs[];
+};
+
+// The image the reservoirs are laid out for, 0 while the lighting isn't resampled
+uniform ivec2 ReservoirSize;
+
+Reservoir EmptyReservoir()
+{
+	return Reservoir(vec3(0), 0.0f, vec3(0), 0.0f, vec3(0), 0.0f);
+}
+
+// The reservoir's sample as a light sample seen from origin, without a pdf. areaToSolidAngle converts densities
+// over the light's area to solid angle at origin, it's 0 if the light faces away.
+LightSample ReservoirLight(Reservoir reservoir, vec3 origin, out float areaToSolidAngle)
+{
+	LightSample light;
+	light.radiance = reservoir.radiance;
+	light.normal = reservoir.lightNormal;
+	light.pdf = 0.0f;
+	if (reservoir.lightNormal == vec3(0))
+	{
+		light.direction = reservoir.lightPoint;
+		light.dst = 1.0f / 0.0f;
+		areaToSolidAngle = 1.0f;
+		return light;
+	}
+	vec3 toLight = reservoir.lightPoint - origin;
+	light.dst = length(toLight);
+	light.direction = toLight / light.dst;
+	float cosine = -dot(light.direction, reservoir.lightNormal);
+	areaToSolidAngle = cosine > 0.0f ? light.dst * light.dst / cosine : 0.0f;
+	return light;
+}
+
+// The density the reservoirs resample towards: the luminance the sample would add to a diffuse surface at origin
+// without shadows, over the light's area
+float ReservoirTarget(Reservoir reservoir, vec3 origin, vec3 normal)
+{
+	float areaToSolidAngle;
+	LightSample light = ReservoirLight(reservoir, origin, areaToSolidAngle);
+	if (areaToSolidAngle <= 0.0f)
+		return 0.0f;
+	return dot(light.radiance, vec3(0.2126f, 0.7152f, 0.0722f)) * max(dot(light.direction, normal), 0.0f) / areaToSolidAngle;
+}
+
+// Streams a sample with resampling weight into the reservoir, it replaces the kept one with probability
+// weight / weightSum. The caller counts the candidates it stands for.
+void StreamSample(inout Reservoir reservoir, Reservoir sample, float weight, float u)
+{
+	reservoir.weightSum += weight;
+	if (weight > 0.0f && u * reservoir.weightSum < weight)
+	{
+		reservoir.lightPoint = sample.lightPoint;
+		reservoir.lightNormal = sample.lightNormal;
+		reservoir.radiance = sample.radiance;
+	}
+}
+
+// Resamples another reservoir's sample into this one as if all of its candidates had been drawn here, target is
+// its sample's target density at this reservoir's pixel
+void MergeReservoir(inout Reservoir reservoir, Reservoir other, float target, float u)
+{
+	StreamSample(reservoir, other, target * other.contributionWeight * other.sampleCount, u);
+	reservoir.sampleCount += other.sampleCount;
+}
+
+// Works out the contribution weight of the sample the reservoir kept, once every candidate went through it
+void FinishReservoir(inout Reservoir reservoir, vec3 origin, vec3 normal)
+{
+	float target = ReservoirTarget(reservoir, origin, normal);
+	reservoir.contributionWeight = target > 0.0f ? reservoir.weightSum / (reservoir.sampleCount * target) : 0.0f;
+}
+
+// The light the pixel's reservoir kept, for a path's first bounce at origin. Its pdf over solid angle is one over
+// the contribution weight. Returns false if the lighting isn't resampled or the pixel's first hit missed, the
+// bounce samples a light of its own then.
+bool ResampledLight(vec3 origin, out LightSample light)
+{
+	if (ReservoirSize.x <= 0 || SampleBounce != 0u)
+		return false;
+	uint pixelCount = uint(ReservoirSize.x * ReservoirSize.y);
+	Reservoir reservoir = reservoirs[pixelCount + SamplerPixel.y * uint(ReservoirSize.x) + SamplerPixel.x];
+	if (reservoir.sampleCount <= 0.0f)
+		return false;
+	float areaToSolidAngle;
+	light = ReservoirLight(reservoir, origin, areaToSolidAngle);
+	light.pdf = reservoir.contributionWeight > 0.0f ? areaToSolidAngle / reservoir.contributionWeight : 0.0f;
+	return true;
+}
+
+// A diffuse bounce's direct light sample, taken from the pixel's reservoir where ResampledLight has one. resampled
+// tells whether it was, it isn't weighed against the scattered path finding the light then.
+LightSample DiffuseDirectLight(vec3 origin, vec3 normal, out bool resampled)
+{
+	LightSample light;
+	resampled = ResampledLight(origin, light);
+	if (!resampled)
+		light = SampleDirectLight(origin, normal);
+	return light;
+}
@@ -0,0 +1,977 @@
+// The scene shared by every ray tracing shader: its buffers, textures, environment and intersection
+// --- Structs ---
+struct Ray
+{
+	vec3 origin;
+	vec3 direction;
+	float ior;
+	// ray cone, its width at the origin and how fast it grows per unit of distance
+	float coneWidth;
+	float coneSpread;
+};
+
+struct Material
+{
+	vec3 albedo; float albedo_pad;
+	vec3 emissionColor;  float emissionColor_pad;
+	float strength;
+	float roughness;
+	float metallic;
+	float ior;
+	// texture ids, bucket in the high 16 bits and layer in the low ones, -1 for none
+	int albedoTexture;
+	int roughnessTexture;
+	int metallicTexture;
+};
+
+// Material features the program is specialized for, those set to 0 are compiled out because no material in the
+// scene uses them. Programs built without the defines handle every material. Must match MaterialFeatures.h.
+#ifndef METALLIC_MATERIALS
+#define METALLIC_MATERIALS 1
+#endif
+#ifndef TRANSPARENT_MATERIALS
+#define TRANSPARENT_MATERIALS 1
+#endif
+#ifndef TEXTURED_MATERIALS
+#define TEXTURED_MATERIALS 1
+#endif
+
+struct HitInfo
+{
+	bool didHit;
+	float dst;
+	vec3 hitPoint;
+	vec3 normal;
+	int materialIndex;
+	vec2 uv;
+	// texture space distance per unit of world space distance on the surface, scales the ray cone into texture space
+	float uvPerUnit;
+};
+
+// What traversal records of the closest hit, the hit's attributes are only worked out for the final one
+#define SPHERE_PRIMITIVE 0
+#define TRIANGLE_PRIMITIVE 1
+struct Intersection
+{
+	float dst; // infinity without a hit
+	vec2 barycentric; // weights of the triangle's second and third corners
+	int primitive; // sphere or triangle index
+	int primitiveType;
+	int meshIndex; // -1 for spheres
+};
+
+struct Sphere
+{
+	vec3 center; float center_pad;
+	float radius;
+	int materialIndex;
+};
+
+struct Triangle
+{
+	vec3 posA;
+	vec3 posB;
+	vec3 posC;
+	vec3 normalA;
+	vec3 normalB;
+	vec3 normalC;
+	vec2 uvA;
+	vec2 uvB;
+	vec2 uvC;
+};
+
+struct MeshInfo
+{
+	mat4 worldToObject;
+	int firstTriangleIndex;
+	int nTriangle;
+	int materialIndex;
+	bool visible;
+	// full resolution first, then each coarser level
+	ivec4 lodRootNodeIndex;
+	vec4 lodError;
+	int lodCount;
+};
+
+struct BVHNode
+{
+	vec3 boundsMin;
+	int leftFirst; // first triangle for leaves, left child otherwise
+	vec3 boundsMax;
+	int triangleCount;
+};
+
+// must match BVH_MAX_DEPTH + 1
+#define BVH_STACK_SIZE 32
+// triangleCount of top level nodes that reference an out-of-core cluster
+#define CLUSTER_NODE -1
+// must match Texture.h
+#define TEXTURE_BUCKET_COUNT 5
+#define TEXTURE_MIN_SIZE 128
+
+// one entry of the environment's alias tables
+struct AliasEntry
+{
+	float threshold;
+	int alias;
+	float pdf; // relative to a uniform choice
+};
+
+// An emissive triangle or sphere in world space. Must match Lights.h.
+#define TRIANGLE_LIGHT 0
+#define SPHERE_LIGHT 1
+struct EmissiveLight
+{
+	vec3 posA; int materialIndex; // the center of spheres
+	vec3 posB; float area; // the radius of spheres in x
+	vec3 posC; int type;
+};
+
+// A node of the tree over the emissive lights, leaves hold a single light and the children of interior nodes
+// are next to each other
+struct LightNode
+{
+	vec3 boundsMin; int leftFirst; // the light for leaves, the left child otherwise
+	vec3 boundsMax; int lightCount; // 1 for leaves
+	vec3 axis; float cosTheta; // every emitting normal below is within acos(cosTheta) of axis
+	float power;
+};
+
+// must match LIGHT_TREE_MAX_DEPTH + 1
+#define LIGHT_TREE_STACK_SIZE 32
+
+struct ClusterState
+{
+	int rootNodeIndex; // -1 while the cluster isn't resident
+	uint lastUsed;
+};
+
+// --- Uniforms ---
+// Camera uniforms
+uniform mat4 InvProjMatrix;
+uniform mat4 InvViewMatrix;
+// Raytracing uniforms
+uniform int NumRaysPerPixel;
+uniform int RayCapacity;
+// LODs are used where their error is below this fraction of the ray cone width, 0 disables them
+uniform float LodErrorScale;
+// Stamped on every cluster a ray reaches, tells the residency manager what to keep and what to load
+uniform uint ResidencyFrame;
+// one texture array per texture size, bucket b holds (TEXTURE_MIN_SIZE << b)² textures
+uniform sampler2DArray TextureBuckets[TEXTURE_BUCKET_COUNT];
+// Equirectangular environment lighting the rays that leave the scene, EnvironmentSize is 0 without one
+uniform sampler2D EnvironmentMap;
+uniform ivec2 EnvironmentSize;
+uniform float EnvironmentStrength;
+// Sum of the emissive surfaces' area times luminance, 0 without any
+uniform float LightPower;
+
+// Shader Storage Buffer Objects (ssbo)
+layout(std430, binding = 1) buffer SphereBuffer {
+	Sphere spheres[];
+};
+
+// vertex attributes are tightly packed xyz floats
+layout(std430, binding = 2) buffer PositionBuffer {
+	float positions[];
+};
+
+layout(std430, binding = 3) buffer MeshInfoBuffer {
+	MeshInfo meshInfos[];
+};
+
+layout(std430, binding = 4) buffer MaterialBuffer {
+	Material materials[];
+};
+
+layout(std430, binding = 5) buffer NormalBuffer {
+	float normals[];
+};
+
+layout(std430, binding = 6) buffer IndexBuffer {
+	uint indices[];
+};
+
+layout(std430, binding = 7) buffer BVHBuffer {
+	BVHNode nodes[];
+};
+
+layout(std430, binding = 8) buffer ClusterBuffer {
+	ClusterState clusters[];
+};
+
+// tightly packed uv floats per vertex
+layout(std430, binding = 9) buffer TexcoordBuffer {
+	float texcoords[];
+};
+
+// the environment's marginal alias table over its rows, followed by a conditional one per row
+layout(std430, binding = 10) buffer EnvironmentBuffer {
+	AliasEntry environmentAlias[];
+};
+
+layout(std430, binding = 16) buffer LightBuffer {
+	EmissiveLight lights[];
+};
+
+layout(std430, binding = 17) buffer LightTreeBuffer {
+	LightNode lightNodes[];
+};
+
+// Set once a ray reaches a cluster that isn't resident, the sample is dropped and retaken once it streamed in
+bool sampleDeferred = false;
+
+vec3 GetPosition(uint vertex)
+{
+	return vec3(positions[3 * vertex], positions[3 * vertex + 1], positions[3 * vertex + 2]);
+}
+
+vec3 GetNormal(uint vertex)
+{
+	return vec3(normals[3 * vertex], normals[3 * vertex + 1], normals[3 * vertex + 2]);
+}
+
+vec2 GetTexcoord(uint vertex)
+{
+	return vec2(texcoords[2 * vertex], texcoords[2 * vertex + 1]);
+}
+
+Triangle GetTriangle(int triangleIndex)
+{
+	uvec3 vertices = uvec3(indices[3 * triangleIndex], indices[3 * triangleIndex + 1], indices[3 * triangleIndex + 2]);
+	Triangle tri;
+	tri.posA = GetPosition(vertices.x);
+	tri.posB = GetPosition(vertices.y);
+	tri.posC = GetPosition(vertices.z);
+	tri.normalA = GetNormal(vertices.x);
+	tri.normalB = GetNormal(vertices.y);
+	tri.normalC = GetNormal(vertices.z);
+	tri.uvA = GetTexcoord(vertices.x);
+	tri.uvB = GetTexcoord(vertices.y);
+	tri.uvC = GetTexcoord(vertices.z);
+	return tri;
+}
+
+// Samples a material texture, footprint is the ray cone's width in texture space and picks the mip level.
+// Sampler arrays can only be indexed with constants, hence the switch.
+vec4 SampleTexture(int textureId, vec2 uv, float footprint)
+{
+	int bucket = textureId >> 16;
+	vec3 coord = vec3(uv, float(textureId & 0xffff));
+	float lod = log2(max(footprint * float(TEXTURE_MIN_SIZE << bucket), 1e-8f));
+	switch (bucket)
+	{
+		case 0: return textureLod(TextureBuckets[0], coord, lod);
+		case 1: return textureLod(TextureBuckets[1], coord, lod);
+		case 2: return textureLod(TextureBuckets[2], coord, lod);
+		case 3: return textureLod(TextureBuckets[3], coord, lod);
+		default: return textureLod(TextureBuckets[4], coord, lod);
+	}
+}
+
+vec3 GetImplicitNormal(vec2 normal)
+{
+	float z = sqrt(1.0f - normal.x * normal.x - normal.y * normal.y);
+	return vec3(normal, z);
+}
+
+// --- Environment ---
+vec2 DirectionToEquirect(vec3 direction)
+{
+	return vec2(atan(direction.z, direction.x) / (2.0f * Pi) + 0.5f, acos(clamp(direction.y, -1.0f, 1.0f)) / Pi);
+}
+
+vec3 EquirectToDirection(vec2 uv)
+{
+	float phi = (uv.x - 0.5f) * 2.0f * Pi;
+	float theta = uv.y * Pi;
+	return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+vec3 EnvironmentRadiance(vec3 direction)
+{
+	return EnvironmentStrength * textureLod(EnvironmentMap, DirectionToEquirect(direction), 0.0f).rgb;
+}
+
+// Converts a texel's pdf over the image into one over solid angle
+float EnvironmentSolidAnglePdf(float texelPdf, vec3 direction)
+{
+	float sinTheta = sqrt(max(1.0f - direction.y * direction.y, 0.0f));
+	return texelPdf / (2.0f * Pi * Pi * max(sinTheta, 1e-6f));
+}
+
+// Pdf of SampleEnvironment choosing the direction
+float EnvironmentPdf(vec3 direction)
+{
+	ivec2 texel = min(ivec2(DirectionToEquirect(direction) * vec2(EnvironmentSize)), EnvironmentSize - 1);
+	return EnvironmentSolidAnglePdf(environmentAlias[EnvironmentSize.y + texel.y * EnvironmentSize.x + texel.x].pdf, direction);
+}
+
+// Picks a direction proportional to the environment's luminance in O(1): a row from the marginal table,
+// a texel from the row's table, then the point jitter in the texel. u picks the column and row, what is left
+// of it after the table's slot decides between the slot and its alias.
+vec3 SampleEnvironment(vec2 u, vec2 jitter, out float pdf)
+{
+	float rowU = u.y * float(EnvironmentSize.y);
+	int row = min(int(rowU), EnvironmentSize.y - 1);
+	if (fract(rowU) >= environmentAlias[row].threshold)
+		row = environmentAlias[row].alias;
+	int rowStart = EnvironmentSize.y + row * EnvironmentSize.x;
+	float columnU = u.x * float(EnvironmentSize.x);
+	int column = min(int(columnU), EnvironmentSize.x - 1);
+	if (fract(columnU) >= environmentAlias[rowStart + column].threshold)
+		column = environmentAlias[rowStart + column].alias;
+
+	vec3 direction = EquirectToDirection((vec2(column, row) + jitter) / vec2(EnvironmentSize));
+	pdf = EnvironmentSolidAnglePdf(environmentAlias[rowStart + column].pdf, direction);
+	return direction;
+}
+
+// Multiple importance sampling weight of a sample from the strategy with pdf a
+float PowerHeuristic(float a, float b)
+{
+	return a * a / max(a * a + b * b, 1e-12f);
+}
+
+// scatterPdf of bounces whose direct light sample was resampled from many candidates, it stands for every light
+// on its own and lights the scattered path finds by chance don't count
+#define RESAMPLED_SCATTER_PDF -1.0f
+
+// Weight of light a path found by scattering with scatterPdf, against the bounce sampling it directly with
+// lightPdf. scatterPdf is 0 after bounces that didn't sample lights.
+float ScatterWeight(float scatterPdf, float lightPdf)
+{
+	if (scatterPdf == RESAMPLED_SCATTER_PDF)
+		return lightPdf > 0.0f ? 0.0f : 1.0f;
+	return scatterPdf > 0.0f && lightPdf > 0.0f ? PowerHeuristic(scatterPdf, lightPdf) : 1.0f;
+}
+
+// --- Direct lighting ---
+// Diffuse surfaces sample a light directly and the paths leaving them may hit one by chance, both are weighed
+// against each other. A direct sample picks the environment or the emissive surfaces, half the time each if
+// there are both.
+float EnvironmentSelectProbability()
+{
+	if (EnvironmentSize.x <= 0)
+		return 0.0f;
+	return LightPower > 0.0f ? 0.5f : 1.0f;
+}
+
+// Pdf over solid angle of a direct sample choosing an escaping direction
+float EnvironmentDirectPdf(vec3 direction)
+{
+	return EnvironmentSelectProbability() * EnvironmentPdf(direction);
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the cosines and sines of both angles
+float CosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+	return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+float SinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+	return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+// Estimate of what the lights below a node contribute at point p with normal n: their power over the squared
+// distance, times bounds on the cosines at both ends over the directions the node's box covers
+float LightNodeImportance(LightNode node, vec3 p, vec3 n)
+{
+	vec3 toPoint = p - (node.boundsMin + node.boundsMax) * 0.5f;
+	float radius = length(node.boundsMax - node.boundsMin) * 0.5f;
+	float d2 = dot(toPoint, toPoint);
+	vec3 wi = toPoint / max(sqrt(d2), 1e-20f);
+
+	// the box subtends every direction once p is inside its bounding sphere
+	float cosThetaB = d2 > radius * radius ? sqrt(max(1.0f - radius * radius / d2, 0.0f)) : -1.0f;
+	float sinThetaB = sqrt(max(1.0f - cosThetaB * cosThetaB, 0.0f));
+	float cosThetaW = dot(node.axis, wi);
+	float sinThetaW = sqrt(max(1.0f - cosThetaW * cosThetaW, 0.0f));
+	float sinThetaO = sqrt(max(1.0f - node.cosTheta * node.cosTheta, 0.0f));
+	float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosTheta);
+	float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.cosTheta);
+	float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	// every light emits over the hemisphere around its normal
+	if (cosThetaP <= 0.0f)
+		return 0.0f;
+
+	// and diffuse surfaces only receive from above
+	float cosThetaI = -dot(wi, n);
+	float sinThetaI = sqrt(max(1.0f - cosThetaI * cosThetaI, 0.0f));
+	float cosThetaPI = CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	return max(node.power * cosThetaP * cosThetaPI / max(d2, radius * radius), 0.0f);
+}
+
+// Walks the light tree from the root, choosing each child in proportion to its importance at p.
+// The uniform u is stretched over the chosen child's share at every level, so one value picks the light.
+// Returns the light and the probability of picking it, -1 if no light can reach p.
+int SampleLightTree(vec3 p, vec3 n, float u, out float pmf)
+{
+	pmf = 1.0f;
+	if (LightNodeImportance(lightNodes[0], p, n) <= 0.0f)
+		return -1;
+	int nodeIndex = 0;
+	while (lightNodes[nodeIndex].lightCount == 0)
+	{
+		int left = lightNodes[nodeIndex].leftFirst;
+		float importanceLeft = LightNodeImportance(lightNodes[left], p, n);
+		float importanceRight = LightNodeImportance(lightNodes[left + 1], p, n);
+		if (importanceLeft + importanceRight <= 0.0f)
+			return -1;
+		float pLeft = importanceLeft / (importanceLeft + importanceRight);
+		if (u < pLeft)
+		{
+			nodeIndex = left;
+			pmf *= pLeft;
+			u /= pLeft;
+		}
+		else
+		{
+			nodeIndex = left + 1;
+			pmf *= 1.0f - pLeft;
+			u = (u - pLeft) / (1.0f - pLeft);
+		}
+		u = min(u, 0.99999994f);
+	}
+	return lightNodes[nodeIndex].leftFirst;
+}
+
+// Whether q, where a ray hit an emissive surface, lies on the light
+bool OnLight(EmissiveLight light, vec3 q)
+{
+	if (light.type == SPHERE_LIGHT)
+		return abs(length(q - light.posA) - light.posB.x) <= 1e-3f * light.posB.x;
+	vec3 edgeAB = light.posB - light.posA;
+	vec3 edgeAC = light.posC - light.posA;
+	vec3 normal = cross(edgeAB, edgeAC);
+	vec3 aq = q - light.posA;
+	float normalLength = length(normal);
+	// within a sliver of the plane, relative to the triangle's size
+	if (abs(dot(aq, normal)) > 1e-3f * normalLength * sqrt(normalLength) + 1e-6f)
+		return false;
+	float u = dot(cross(aq, edgeAC), normal) / (normalLength * normalLength);
+	float v = dot(cross(edgeAB, aq), normal) / (normalLength * normalLength);
+	return u >= -1e-4f && v >= -1e-4f && u + v <= 1.0f + 1e-4f;
+}
+
+bool InLightNode(LightNode node, vec3 q)
+{
+	vec3 margin = (node.boundsMax - node.boundsMin) * 1e-3f + 1e-4f;
+	return all(greaterThanEqual(q, node.boundsMin - margin)) && all(lessThanEqual(q, node.boundsMax + margin));
+}
+
+// Density over area of SampleLightTree at p and a uniform point on the light landing on q. Every branch whose
+// bounds hold q is walked down to the lights q lies on, the hit doesn't have to know which light it found.
+float LightTreeAreaPdf(vec3 p, vec3 n, vec3 q)
+{
+	if (LightNodeImportance(lightNodes[0], p, n) <= 0.0f)
+		return 0.0f;
+	int stack[LIGHT_TREE_STACK_SIZE];
+	float stackPmf[LIGHT_TREE_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackPmf[stackSize++] = 1.0f;
+	float pdf = 0.0f;
+	while (stackSize > 0)
+	{
+		--stackSize;
+		LightNode node = lightNodes[stack[stackSize]];
+		float pmf = stackPmf[stackSize];
+		if (node.lightCount > 0)
+		{
+			EmissiveLight light = lights[node.leftFirst];
+			if (OnLight(light, q))
+				pdf += pmf / light.area;
+			continue;
+		}
+
+		int left = node.leftFirst;
+		float importanceLeft = LightNodeImportance(lightNodes[left], p, n);
+		float importanceRight = LightNodeImportance(lightNodes[left + 1], p, n);
+		float importance = importanceLeft + importanceRight;
+		if (importanceLeft > 0.0f && InLightNode(lightNodes[left], q))
+		{
+			stack[stackSize] = left;
+			stackPmf[stackSize++] = pmf * importanceLeft / importance;
+		}
+		if (importanceRight > 0.0f && InLightNode(lightNodes[left + 1], q))
+		{
+			stack[stackSize] = left + 1;
+			stackPmf[stackSize++] = pmf * importanceRight / importance;
+		}
+	}
+	return pdf;
+}
+
+// Pdf over solid angle of a direct sample from p with normal n landing on an emissive surface at q, dst away.
+// cosine is between the direction towards the surface and its normal.
+float EmissivePdf(vec3 p, vec3 n, vec3 q, float dst, float cosine)
+{
+	if (LightPower <= 0.0f || cosine <= 0.0f)
+		return 0.0f;
+	return (1.0f - EnvironmentSelectProbability()) * LightTreeAreaPdf(p, n, q) * dst * dst / cosine;
+}
+
+struct LightSample
+{
+	vec3 direction;
+	float dst; // infinite for the environment
+	vec3 radiance;
+	float pdf; // over solid angle, 0 if nothing was sampled
+	vec3 normal; // of the light's surface at the sample, 0 for the environment
+};
+
+// Samples the environment or a point on one of the emissive surfaces as seen from origin, lights are picked by
+// their estimated contribution at a surface with this normal
+LightSample SampleDirectLight(vec3 origin, vec3 normal)
+{
+	LightSample light;
+	light.pdf = 0.0f;
+	float environmentProbability = EnvironmentSelectProbability();
+	float pick = Sample1D(SAMPLE_LIGHT_PICK);
+	if (pick < environmentProbability)
+	{
+		light.direction = SampleEnvironment(Sample2D(SAMPLE_LIGHT), Sample2D(SAMPLE_LIGHT_JITTER), light.pdf);
+		light.pdf *= environmentProbability;
+		light.dst = 1.0f / 0.0f;
+		light.radiance = EnvironmentRadiance(light.direction);
+		light.normal = vec3(0);
+		return light;
+	}
+	if (LightPower <= 0.0f)
+		return light;
+
+	float pmf;
+	int index = SampleLightTree(origin, normal, min((pick - environmentProbability) / (1.0f - environmentProbability), 0.99999994f), pmf);
+	if (index < 0)
+		return light;
+	EmissiveLight emissive = lights[index];
+	vec3 point;
+	vec3 lightNormal;
+	vec2 u = Sample2D(SAMPLE_LIGHT);
+	if (emissive.type == SPHERE_LIGHT)
+	{
+		lightNormal = SampleSphere(u);
+		point = emissive.posA + lightNormal * emissive.posB.x;
+	}
+	else
+	{
+		// uniform over the triangle
+		float s = sqrt(u.x);
+		float t = u.y;
+		point = emissive.posA * (1.0f - s) + emissive.posB * (s * (1.0f - t)) + emissive.posC * (s * t);
+		lightNormal = normalize(cross(emissive.posB - emissive.posA, emissive.posC - emissive.posA));
+	}
+	vec3 toLight = point - origin;
+	light.dst = length(toLight);
+	light.direction = toLight / light.dst;
+	Material material = materials[emissive.materialIndex];
+	light.radiance = material.emissionColor * material.strength;
+	light.normal = lightNormal;
+	// surfaces only emit from the side rays can hit them from
+	float cosine = -dot(light.direction, lightNormal);
+	if (cosine > 0.0f)
+		light.pdf = (1.0f - environmentProbability) * pmf / emissive.area * light.dst * light.dst / cosine;
+	return light;
+}
+
+// --- Ray Intersection Functions ---
+// Distance along the ray to the sphere's near side, infinity if it's missed or behind the ray
+float RaySphereDistance(Ray ray, Sphere sphere)
+{
+	vec3 offsetRayOrigin = ray.origin - sphere.center;
+	// From the equation: sqrLength(rayOrigin + rayDir * dst) = radius^2
+	// Solving for dst results in a quadratic equation with coefficients:
+	float a = dot(ray.direction, ray.direction); // a = 1 (assuming unit vector)
+	float b = 2 * dot(offsetRayOrigin, ray.direction);
+	float c = dot(offsetRayOrigin, offsetRayOrigin) - sphere.radius * sphere.radius;
+	// Quadratic discriminant
+	float discriminant = b * b - 4 * a * c;
+
+	// No solution when d < 0 (ray misses sphere)
+	if (discriminant < 0)
+		return 1.0f/0.0f;
+	// Distance to nearest intersection point (from quadratic formula), ignoring intersections behind the ray
+	float dst = (-b - sqrt(discriminant)) / (2 * a);
+	return dst >= 0 ? dst : 1.0f/0.0f;
+}
+
+// Whether the ray hits the sphere closer than tMax, without working out where
+bool RaySphereOccludes(Ray ray, Sphere sphere, float tMax)
+{
+	return RaySphereDistance(ray, sphere) < tMax;
+}
+
+// Distance along the ray to a triangle using Möller–Trumbore algorithm, infinity if it's missed. Only its
+// corners are read, the rest of the triangle waits until it's known to be the closest hit.
+float RayTriangleDistance(Ray ray, int triangleIndex, out vec2 barycentric)
+{
+	vec3 posA = GetPosition(indices[3 * triangleIndex]);
+	vec3 edgeAB = GetPosition(indices[3 * triangleIndex + 1]) - posA;
+	vec3 edgeAC = GetPosition(indices[3 * triangleIndex + 2]) - posA;
+	vec3 normalVector = cross(edgeAB, edgeAC);
+	vec3 ao = ray.origin - posA;
+	vec3 dao = cross(ao, ray.direction);
+
+	float determinant = -dot(ray.direction, normalVector);
+	float invDet = 1 / determinant;
+
+	// Calculate dst to triangle & barycentric coordinates of intersection point
+	float dst = dot(ao, normalVector) * invDet;
+	float u = dot(edgeAC, dao) * invDet;
+	float v = -dot(edgeAB, dao) * invDet;
+	barycentric = vec2(u, v);
+	bool didHit = determinant >= 1E-6 && dst >= 0 && u >= 0 && v >= 0 && u + v <= 1;
+	return didHit ? dst : 1.0f/0.0f;
+}
+
+// Whether the ray hits the triangle closer than tMax
+bool RayTriangleOccludes(Ray ray, int triangleIndex, float tMax)
+{
+	vec2 barycentric;
+	return RayTriangleDistance(ray, triangleIndex, barycentric) < tMax;
+}
+
+// Distance along the ray to an axis aligned box, infinity if it's missed
+float RayBoundsDistance(Ray ray, vec3 invDirection, vec3 boundsMin, vec3 boundsMax)
+{
+	vec3 t0 = (boundsMin - ray.origin) * invDirection;
+	vec3 t1 = (boundsMax - ray.origin) * invDirection;
+	vec3 tMin = min(t0, t1);
+	vec3 tMax = max(t0, t1);
+	float dstNear = max(max(tMin.x, tMin.y), tMin.z);
+	float dstFar = min(min(tMax.x, tMax.y), tMax.z);
+	return dstFar >= max(dstNear, 0.0f) ? max(dstNear, 0.0f) : 1.0f/0.0f;
+}
+
+// Walk a mesh's BVH front to back, skipping nodes further away than the closest hit so far
+void TraverseMesh(Ray ray, vec3 invDirection, int rootNodeIndex, int meshIndex, inout Intersection closestHit)
+{
+	BVHNode root = nodes[rootNodeIndex];
+	if (RayBoundsDistance(ray, invDirection, root.boundsMin, root.boundsMax) >= closestHit.dst)
+		return;
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = rootNodeIndex;
+	while (stackSize > 0)
+	{
+		BVHNode node = nodes[stack[--stackSize]];
+		if (node.triangleCount == CLUSTER_NODE)
+		{
+			// continue into the cluster's resident copy, if it has one
+			clusters[node.leftFirst].lastUsed = ResidencyFrame;
+			int clusterRoot = clusters[node.leftFirst].rootNodeIndex;
+			if (clusterRoot < 0)
+				sampleDeferred = true;
+			else
+				stack[stackSize++] = clusterRoot;
+			continue;
+		}
+		if (node.triangleCount > 0)
+		{
+			for (int i = 0; i < node.triangleCount; i++) {
+				vec2 barycentric;
+				float dst = RayTriangleDistance(ray, node.leftFirst + i, barycentric);
+
+				if (dst < closestHit.dst)
+					closestHit = Intersection(dst, barycentric, node.leftFirst + i, TRIANGLE_PRIMITIVE, meshIndex);
+			}
+			continue;
+		}
+
+		int childA = node.leftFirst;
+		int childB = node.leftFirst + 1;
+		float dstA = RayBoundsDistance(ray, invDirection, nodes[childA].boundsMin, nodes[childA].boundsMax);
+		float dstB = RayBoundsDistance(ray, invDirection, nodes[childB].boundsMin, nodes[childB].boundsMax);
+
+		// push the far child first so the near one is visited next
+		bool isNearestA = dstA <= dstB;
+		float dstNear = isNearestA ? dstA : dstB;
+		float dstFar = isNearestA ? dstB : dstA;
+		int childNear = isNearestA ? childA : childB;
+		int childFar = isNearestA ? childB : childA;
+
+		if (dstFar < closestHit.dst) stack[stackSize++] = childFar;
+		if (dstNear < closestHit.dst) stack[stackSize++] = childNear;
+	}
+}
+
+// Any hit in a mesh's BVH closer than tMax ends the walk, the order nodes are visited in doesn't matter
+bool MeshOccludes(Ray ray, vec3 invDirection, int rootNodeIndex, float tMax)
+{
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = rootNodeIndex;
+	while (stackSize > 0)
+	{
+		BVHNode node = nodes[stack[--stackSize]];
+		if (RayBoundsDistance(ray, invDirection, node.boundsMin, node.boundsMax) >= tMax)
+			continue;
+		if (node.triangleCount == CLUSTER_NODE)
+		{
+			// continue into the cluster's resident copy, if it has one
+			clusters[node.leftFirst].lastUsed = ResidencyFrame;
+			int clusterRoot = clusters[node.leftFirst].rootNodeIndex;
+			if (clusterRoot < 0)
+				sampleDeferred = true;
+			else
+				stack[stackSize++] = clusterRoot;
+			continue;
+		}
+		if (node.triangleCount > 0)
+		{
+			for (int i = 0; i < node.triangleCount; i++)
+				if (RayTriangleOccludes(ray, node.leftFirst + i, tMax))
+					return true;
+			continue;
+		}
+		stack[stackSize++] = node.leftFirst;
+		stack[stackSize++] = node.leftFirst + 1;
+	}
+	return false;
+}
+
+// The root of the coarsest LOD whose error still fits in the ray cone where it reaches the mesh, -1 if the ray
+// misses the mesh's bounds
+int MeshRootNode(MeshInfo meshInfo, Ray ray, Ray objectRay, vec3 invDirection)
+{
+	int rootNodeIndex = meshInfo.lodRootNodeIndex.x;
+	if (LodErrorScale > 0.0f && meshInfo.lodCount > 1)
+	{
+		BVHNode root = nodes[rootNodeIndex];
+		float dst = RayBoundsDistance(objectRay, invDirection, root.boundsMin, root.boundsMax);
+		if (isinf(dst))
+			return -1;
+		// the error is in object space, the unnormalized direction's length converts the width into it
+		float footprint = (ray.coneWidth + ray.coneSpread * dst) * length(objectRay.direction) * LodErrorScale;
+		for (int lod = meshInfo.lodCount - 1; lod > 0; --lod)
+		{
+			if (meshInfo.lodError[lod] <= footprint)
+				return meshInfo.lodRootNodeIndex[lod];
+		}
+	}
+	return rootNodeIndex;
+}
+
+// The ray in a mesh's object space, the direction is left unnormalized so distances stay in world units
+Ray ObjectRay(Ray ray, MeshInfo meshInfo)
+{
+	Ray objectRay = ray;
+	objectRay.origin = (meshInfo.worldToObject * vec4(ray.origin, 1.0f)).xyz;
+	objectRay.direction = mat3(meshInfo.worldToObject) * ray.direction;
+	return objectRay;
+}
+
+// The attributes of the hit an intersection recorded: where it is, its shading normal, texture coordinates and
+// material
+HitInfo HitAttributes(Ray ray, Intersection intersection)
+{
+	HitInfo hitInfo;
+	hitInfo.didHit = !isinf(intersection.dst);
+	hitInfo.dst = intersection.dst;
+	if (!hitInfo.didHit)
+		return hitInfo;
+	hitInfo.hitPoint = ray.origin + ray.direction * intersection.dst;
+
+	if (intersection.primitiveType == SPHERE_PRIMITIVE)
+	{
+		Sphere sphere = spheres[intersection.primitive];
+		hitInfo.normal = normalize(hitInfo.hitPoint - sphere.center);
+		// spherical mapping, v runs pole to pole over half the circumference
+		hitInfo.uv = vec2(atan(hitInfo.normal.z, hitInfo.normal.x) / (2.0f * Pi) + 0.5f, asin(hitInfo.normal.y) / Pi + 0.5f);
+		hitInfo.uvPerUnit = 1.0f / (Pi * sphere.radius);
+		hitInfo.materialIndex = sphere.materialIndex;
+		return hitInfo;
+	}
+
+	// triangles were hit in their mesh's object space
+	MeshInfo meshInfo = meshInfos[intersection.meshIndex];
+	Triangle tri = GetTriangle(intersection.primitive);
+	float u = intersection.barycentric.x;
+	float v = intersection.barycentric.y;
+	float w = 1 - u - v;
+	hitInfo.normal = normalize(transpose(mat3(meshInfo.worldToObject)) * (tri.normalA * w + tri.normalB * u + tri.normalC * v));
+	hitInfo.uv = tri.uvA * w + tri.uvB * u + tri.uvC * v;
+	// the ratio of the triangle's areas in texture and object space, scaled to world space by the object ray's length
+	vec2 uvAB = tri.uvB - tri.uvA;
+	vec2 uvAC = tri.uvC - tri.uvA;
+	float area = length(cross(tri.posB - tri.posA, tri.posC - tri.posA));
+	hitInfo.uvPerUnit = sqrt(abs(uvAB.x * uvAC.y - uvAB.y * uvAC.x) / area) * length(mat3(meshInfo.worldToObject) * ray.direction);
+	hitInfo.materialIndex = meshInfo.materialIndex;
+	return hitInfo;
+}
+
+// Find the first point that the given ray collides with, and return hit info. Traversal only keeps the closest
+// intersection, its attributes are evaluated once at the end.
+HitInfo CollisionDetection(Ray ray)
+{
+	Intersection closest;
+	closest.dst = 1.0f/0.0f; // 'closest' hit is infinitely far away
+
+	// check against spheres
+	for(int sphereIndex = 0; sphereIndex < spheres.length(); sphereIndex++){
+		float dst = RaySphereDistance(ray, spheres[sphereIndex]);
+		if (dst < closest.dst)
+			closest = Intersection(dst, vec2(0), sphereIndex, SPHERE_PRIMITIVE, -1);
+	}
+
+	//check against meshes
+	for (int meshIndex = 0; meshIndex < meshInfos.length(); meshIndex ++)
+	{
+		MeshInfo meshInfo = meshInfos[meshIndex];
+		if (!meshInfo.visible)
+			continue;
+
+		// Trace instances in object space
+		Ray objectRay = ObjectRay(ray, meshInfo);
+		vec3 invDirection = 1.0f / objectRay.direction;
+		int rootNodeIndex = MeshRootNode(meshInfo, ray, objectRay, invDirection);
+		if (rootNodeIndex < 0)
+			continue;
+
+		TraverseMesh(objectRay, invDirection, rootNodeIndex, meshIndex, closest);
+	}
+	return HitAttributes(ray, closest);
+}
+
+// Whether anything lies on the ray closer than tMax. Stops at the first hit it finds and never works out
+// where the hit is, for visibility it only matters that there is one.
+bool Occluded(Ray ray, float tMax)
+{
+	for (int sphereIndex = 0; sphereIndex < spheres.length(); sphereIndex++)
+		if (RaySphereOccludes(ray, spheres[sphereIndex], tMax))
+			return true;
+
+	for (int meshIndex = 0; meshIndex < meshInfos.length(); meshIndex++)
+	{
+		MeshInfo meshInfo = meshInfos[meshIndex];
+		if (!meshInfo.visible)
+			continue;
+		Ray objectRay = ObjectRay(ray, meshInfo);
+		vec3 invDirection = 1.0f / objectRay.direction;
+		int rootNodeIndex = MeshRootNode(meshInfo, ray, objectRay, invDirection);
+		if (rootNodeIndex >= 0 && MeshOccludes(objectRay, invDirection, rootNodeIndex, tMax))
+			return true;
+	}
+	return false;
+}
+
+// Whether a shadow ray gets dst far without hitting anything, the light it aims for doesn't count
+bool Unoccluded(Ray ray, float dst)
+{
+	return !Occluded(ray, dst * 0.999f);
+}
+
+// Angle between the camera rays through texCoord and the pixel texelHeight above it
+float PixelSpread(vec2 texCoord, float texelHeight)
+{
+	vec4 viewPos = InvProjMatrix * vec4(texCoord * 2.0f - 1.0f, 0.0f, 1.0f);
+	vec4 neighbourPos = InvProjMatrix * vec4((texCoord + vec2(0.0f, texelHeight)) * 2.0f - 1.0f, 0.0f, 1.0f);
+	return length(normalize(neighbourPos.xyz) - normalize(viewPos.xyz));
+}
+
+// A camera ray through texCoord, its cone starting out as wide as the spread between neighbouring pixels
+Ray CameraRay(vec2 texCoord, float pixelSpread)
+{
+	// Start from transformed position
+	vec4 viewPos = InvProjMatrix * vec4(texCoord * 2.0f - 1.0f, 0.0f, 1.0f);
+
+	Ray ray;
+	ray.ior = 1.0f;
+	ray.coneWidth = 0.0f;
+	ray.coneSpread = pixelSpread;
+
+	// Calculate ray origin and direction
+	float Focus = 100.0f;
+	vec3 defocusJitter = SampleSphere(Sample2D(SAMPLE_CAMERA)) * (1 - 0.01f * Focus);
+	ray.origin = viewPos.xyz + vec3(1,0,0) * defocusJitter.x + vec3(0,1,0) * defocusJitter.y;
+	ray.direction = normalize(ray.origin);
+
+	// Move ray into world space, where the scene is stored
+	ray.origin = (InvViewMatrix * vec4(ray.origin, 1.0f)).xyz;
+	ray.direction = normalize(mat3(InvViewMatrix) * ray.direction);
+	return ray;
+}
+
+// The material at a hit with its textures applied, the ray has to have moved to the hit already.
+// The ray cone's width in texture space picks the textures' mip level.
+Material SurfaceMaterial(HitInfo hitinfo, Ray ray)
+{
+	Material material = materials[hitinfo.materialIndex];
+#if TEXTURED_MATERIALS
+	float uvFootprint = ray.coneWidth * hitinfo.uvPerUnit / max(abs(dot(ray.direction, hitinfo.normal)), 0.1f);
+	if (material.albedoTexture >= 0)
+		material.albedo *= pow(SampleTexture(material.albedoTexture, hitinfo.uv, uvFootprint).rgb, vec3(2.2f));
+	if (material.roughnessTexture >= 0)
+		material.roughness *= SampleTexture(material.roughnessTexture, hitinfo.uv, uvFootprint).g;
+	if (material.metallicTexture >= 0)
+		material.metallic *= SampleTexture(material.metallicTexture, hitinfo.uv, uvFootprint).b;
+#endif
+	// constants let the compiler fold away what depends on the features the scene doesn't use
+#if !METALLIC_MATERIALS
+	material.metallic = 0.0f;
+#endif
+#if !TRANSPARENT_MATERIALS
+	material.ior = 0.0f;
+#endif
+	return material;
+}
+
+// Schlick's approximation, dielectrics reflect 4% head on and metals their albedo
+vec3 SurfaceFresnel(vec3 albedo, float metallic, vec3 direction, vec3 normal)
+{
+	vec3 F0 = mix(vec3(0.04f), albedo, metallic);
+	return F0 + (vec3(1.0f) - F0) * pow(1.0f - max(dot(-direction, normal), 0), 5.0f);
+}
+
+// Smith's masking term of the GGX distribution for a direction at cosine nDotV to the normal
+float SmithGGX(float nDotV, float alpha)
+{
+	float alpha2 = alpha * alpha;
+	return 2.0f * nDotV / (nDotV + sqrt(alpha2 + (1.0f - alpha2) * nDotV * nDotV));
+}
+
+// Density of the GGX distribution's microfacet normals at cosine nDotH to the normal
+float GGXDistribution(float nDotH, float alpha)
+{
+	float alpha2 = alpha * alpha;
+	float d = nDotH * nDotH * (alpha2 - 1.0f) + 1.0f;
+	return alpha2 / (Pi * d * d);
+}
+
+// Reflects the ray off a microfacet sampled from the GGX distribution's normals visible to it, roughness squared
+// is its alpha. weight is the BRDF times the cosine over the pdf without the Fresnel term, which leaves the
+// reflection's Smith masking, and 0 if the reflection went into the surface.
+vec3 SampleSpecular(vec3 direction, vec3 normal, float roughness, out float weight)
+{
+	float alpha = roughness * roughness;
+	vec3 n = dot(direction, normal) > 0.0f ? -normal : normal;
+	vec3 microfacet = SampleGGXVisible(n, -direction, alpha, Sample2D(SAMPLE_SCATTER));
+	vec3 reflected = reflect(direction, microfacet);
+	float nDotL = dot(reflected, n);
+	weight = nDotL > 0.0f ? SmithGGX(nDotL, alpha) : 0.0f;
+	return reflected;
+}
+
+// Specular surfaces at least this rough sample lights directly, sharper reflections find them well on their own
+#define GLOSSY_MIN_ROUGHNESS 0.1f
+
+// The specular lobe reflecting the ray's direction towards light: its BRDF times the cosine without the Fresnel
+// term, and the pdf of SampleSpecular reflecting there. Both are 0 for light below the surface.
+float EvaluateSpecular(vec3 direction, vec3 light, vec3 normal, float roughness, out float pdf)
+{
+	// perfect mirrors have no density to speak of
+	float alpha = max(roughness * roughness, 1e-4f);
+	vec3 n = dot(direction, normal) > 0.0f ? -normal : normal;
+	float nDotV = max(-dot(direction, n), 1e-6f);
+	float nDotL = dot(light, n);
+	pdf = 0.0f;
+	if (nDotL <= 0.0f)
+		return 0.0f;
+	vec3 microfacet = normalize(light - direction);
+	// the visible normal's density over the reflection's 4 * dot(view, h)
+	pdf = GGXDistribution(max(dot(microfacet, n), 0.0f), alpha) * SmithGGX(nDotV, alpha) / (4.0f * nDotV);
+	return pdf * SmithGGX(nDotL, alpha);
+}
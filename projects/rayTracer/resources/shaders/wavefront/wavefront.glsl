@@ -0,0 +1,133 @@
+
+// --- Wavefront path tracing ---
+// Every path lives in the path buffer between stages. Each stage is its own compute shader working through a
+// queue of path indices, so the lanes of a work group all run the same kind of work. Must match Wavefront.h.
+#define WAVEFRONT_GROUP_SIZE 64
+// the extension queues take turns, one is traced while shading fills the other
+#define EXTEND_QUEUE_A 0
+#define EXTEND_QUEUE_B 1
+#define DIFFUSE_QUEUE 2
+#define SPECULAR_QUEUE 3
+#define REFRACT_QUEUE 4
+#define SHADOW_QUEUE 5
+#define QUEUE_COUNT 6
+
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+struct PathState
+{
+	vec3 origin; float ior;
+	vec3 direction; float coneWidth;
+	vec3 throughput; float coneSpread;
+	vec3 radiance; float scatterPdf;
+	// the surface the path is at and its material, with the textures applied
+	vec3 normal; float roughness;
+	vec3 albedo; float metallic;
+	float materialIor;
+	// which of the pixel's samples the path is and how many times it bounced, for the sampler
+	uint sampleIndex;
+	uint deferred;
+	uint completedSamples;
+	// the pixel's sum over the frame's samples so far
+	vec3 sampleSum; uint bounce;
+};
+
+// A shadow ray towards a light and what it adds to its path if nothing is in the way
+struct ShadowRay
+{
+	vec3 origin; int pathIndex;
+	vec3 direction; float coneWidth;
+	vec3 contribution; float coneSpread;
+	float dst; // how far the light is, infinite for the environment
+};
+
+// A queue's length followed by the work groups to dispatch for it, read by glDispatchComputeIndirect
+struct QueueCounter
+{
+	uint count;
+	uint groupsX;
+	uint groupsY;
+	uint groupsZ;
+};
+
+layout(std430, binding = 11) buffer PathBuffer {
+	PathState paths[];
+};
+
+layout(std430, binding = 12) buffer QueueCounterBuffer {
+	QueueCounter queueCounters[QUEUE_COUNT];
+};
+
+// queue q holds its path indices from q * PathCapacity on
+layout(std430, binding = 13) buffer QueueBuffer {
+	uint queueItems[];
+};
+
+layout(std430, binding = 14) buffer ShadowRayBuffer {
+	ShadowRay shadowRays[];
+};
+
+uniform uint PathCapacity;
+// the wave of paths being traced covers PathCount pixels from FirstPixel on
+uniform uint FirstPixel;
+uniform uint PathCount;
+uniform ivec2 ImageSize;
+// the extension queue this stage traces or fills
+uniform int ExtendQueue;
+
+void PushQueue(int queue, uint pathIndex)
+{
+	uint slot = atomicAdd(queueCounters[queue].count, 1u);
+	queueItems[uint(queue) * PathCapacity + slot] = pathIndex;
+}
+
+// The path this invocation works on, -1 past the end of the queue
+int QueueItem(int queue)
+{
+	uint slot = gl_GlobalInvocationID.x;
+	return slot < queueCounters[queue].count ? int(queueItems[uint(queue) * PathCapacity + slot]) : -1;
+}
+
+uvec2 PathPixel(uint pathIndex)
+{
+	uint pixelIndex = FirstPixel + pathIndex;
+	return uvec2(pixelIndex % uint(ImageSize.x), pixelIndex / uint(ImageSize.x));
+}
+
+// Picks the path's sample up where the last stage left it
+void ResumeSampler(int pathIndex, PathState path)
+{
+	InitSampler(PathPixel(uint(pathIndex)), path.sampleIndex);
+	SampleBounce = path.bounce;
+}
+
+Ray PathRay(PathState path)
+{
+	Ray ray;
+	ray.origin = path.origin;
+	ray.direction = path.direction;
+	ray.ior = path.ior;
+	ray.coneWidth = path.coneWidth;
+	ray.coneSpread = path.coneSpread;
+	return ray;
+}
+
+// Russian roulette, paths that can't contribute much end early and the survivors make up for them
+bool ContinuePath(inout PathState path)
+{
+	float p = max(path.throughput.r, max(path.throughput.g, path.throughput.b));
+	if (Sample1D(SAMPLE_ROULETTE) >= p)
+		return false;
+	path.throughput *= 1.0f / p;
+	return true;
+}
+
+// Stores the path and queues it for the next extension if it goes on
+void FinishShading(int pathIndex, PathState path)
+{
+	bool continues = ContinuePath(path);
+	path.bounce++;
+	paths[pathIndex] = path;
+	if (continues)
+		PushQueue(ExtendQueue, uint(pathIndex));
+}
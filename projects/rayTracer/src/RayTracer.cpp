@@ -1,9 +1,12 @@
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <iostream>
 #include <span>
+#include <string_view>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -12,7 +15,21 @@
 #include "../include/Mesh.h"
 #include "../include/json.hpp"
 #include "../include/Camera.h"
+#include "../include/ClusterResidency.h"
+#include "../include/Denoiser.h"
+#include "../include/Environment.h"
+#include "../include/FileWatcher.h"
+#include "../include/Lights.h"
+#include "../include/MaterialFeatures.h"
+#include "../include/ResampledLighting.h"
+#include "../include/SceneLoader.h"
+#include "../include/SceneReload.h"
+#include "../include/ShaderProgram.h"
 #include "../include/SSBO.h"
+#include "../include/TemporalReprojection.h"
+#include "../include/TextureArray.h"
+#include "../include/TiledRenderer.h"
+#include "../include/Wavefront.h"
 
 
 // program info/pramas
@@ -23,6 +40,8 @@ unsigned int frameCount = 0;
 
 int numberOfRays = 1;
 int numberOfbounches = 8;
+float lodErrorScale = 1.0f;
+float environmentStrength = 1.0f;
 
 // camera params
 bool cameraEnabled = false;
@@ -32,18 +51,114 @@ glm::vec2 lastMousePosition;
 // uniform locations
 GLint raysLocation;
 GLint bounchesLocation;
+GLint lodErrorScaleLocation;
 GLint invProjMatrixLocation;
+GLint invViewMatrixLocation;
 GLint frameCountLocation;
+GLint reservoirSizeLocation;
+GLint residencyFrameLocation;
+GLint textureBucketsLocation;
+GLint environmentMapLocation;
+GLint environmentSizeLocation;
+GLint environmentStrengthLocation;
+GLint lightPowerLocation;
 GLint sourceTextureLocation;
 GLuint screenTexture;
+glm::ivec2 screenTextureSize;
+GLuint environmentTexture = 0;
+// the HDR lighting the rays that miss the scene, set with --environment <path> or from the UI
+char environmentPath[256] = "resources/environment/environment.hdr";
+constexpr GLint environmentTextureUnit = 1 + TEXTURE_BUCKET_COUNT;
+glm::ivec2 environmentSize{0};
+// sum of the emissive surfaces' area times luminance, the shader samples them directly when it's above 0
+float lightPower = 0.0f;
 
 GLint screenTexturePtr;
 // scene data
 std::vector<std::shared_ptr<Sphere>> spheres{};
-std::vector<std::shared_ptr<Triangle>> triangles{};
+Geometry geometry;
+MappedFile sceneCacheFile;
 std::vector<std::shared_ptr<Mesh>> meshes{};
 std::vector<std::shared_ptr<Material>> materials{};
 
+// scene sources, edits to them are reloaded while the viewer runs
+const std::string materialsPath = "resources/materials/materials.json";
+const std::vector<std::string> modelPaths{
+	"resources/models/CornellBox.obj"
+};
+const std::vector<const char*> vertexShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/renderer/fullscreen.vert"
+};
+const std::vector<const char*> rayTracingShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/random.glsl",
+	"resources/shaders/scene.glsl",
+	"resources/shaders/restir.glsl",
+	"resources/shaders/pathtrace.glsl",
+	"resources/shaders/raytracing.frag"
+};
+// every wavefront stage is built from these followed by its own compute shader
+const std::vector<const char*> wavefrontShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/random.glsl",
+	"resources/shaders/scene.glsl",
+	"resources/shaders/restir.glsl",
+	"resources/shaders/wavefront/wavefront.glsl"
+};
+const std::vector<const char*> tiledShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/random.glsl",
+	"resources/shaders/scene.glsl",
+	"resources/shaders/restir.glsl",
+	"resources/shaders/pathtrace.glsl",
+	"resources/shaders/tiled/tiled.comp"
+};
+const std::vector<const char*> reprojectShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/random.glsl",
+	"resources/shaders/scene.glsl",
+	"resources/shaders/temporal/reproject.comp"
+};
+const std::vector<const char*> resampleShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/random.glsl",
+	"resources/shaders/scene.glsl",
+	"resources/shaders/restir.glsl",
+	"resources/shaders/restir/resample.comp"
+};
+const std::vector<const char*> denoiseShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/denoise/atrous.comp"
+};
+const std::vector<const char*> copyShaderPaths{
+	"resources/shaders/version430.glsl",
+	"resources/shaders/renderer/copy.frag"
+};
+// linked program binaries, rebuilt whenever the sources or the driver change
+const char *rayTracingProgramCachePath = "resources/cache/raytracing.rtprogram";
+const char *copyProgramCachePath = "resources/cache/copy.rtprogram";
+// the material features the path tracing programs are built for, they follow the materials the scene uses
+unsigned materialFeatures = ALL_MATERIAL_FEATURES;
+FileWatcher fileWatcher;
+// where each model sits in the scene, empty for clustered scenes
+std::vector<ModelRecord> modelRecords;
+size_t jsonMaterialCount = 0;
+std::shared_ptr<TextureLibrary> textureLibrary;
+
+// background scene loading, batches are uploaded a slice per frame
+std::unique_ptr<SceneLoader> sceneLoader;
+std::shared_ptr<SceneBatch> uploadingBatch;
+size_t uploadingOffsets[5]{};
+size_t uploadedBytes = 0;
+constexpr size_t sceneUploadBudget = 32 << 20;
+
+// Out-of-core mode: above 0 the scene is cut into clusters that are paged through a pool of this many bytes,
+// set with --cluster-pool <MiB>
+size_t clusterPoolBytes = 0;
+std::vector<ClusterRecord> clusters;
+std::unique_ptr<ClusterResidency> clusterResidency;
+
 // Buffers
 GLuint VertexBufferObject;
 GLuint VertexArrayObject;
@@ -51,18 +166,54 @@ GLuint screenFramebuffer;
 // shader programs
 GLuint shaderProgram;
 GLuint copyShaderProgram;
+// The compute renderers trace instead of the fragment shader, each is created when first selected
+enum RenderMode { FRAGMENT_RENDER, WAVEFRONT_RENDER, TILED_RENDER };
+int renderMode = FRAGMENT_RENDER;
+std::unique_ptr<WavefrontRenderer> wavefront;
+std::unique_ptr<TiledRenderer> tiled;
+AdaptiveSampling adaptiveSampling;
+// camera moves keep the accumulation where it still applies, capped at historyLength samples a pixel.
+// Every restart of the accumulation goes through it, it stores the first hits the denoiser is guided by.
+bool temporalReprojection = true;
+int historyLength = 16;
+std::unique_ptr<TemporalReprojection> temporal;
+// the first bounce takes its direct light from reservoirs resampled at the first hits
+ResamplingSettings resampling;
+std::unique_ptr<ResampledLighting> resampledLighting;
+DenoiseSettings denoiseSettings;
+std::unique_ptr<Denoiser> denoiser;
+// set when the accumulation restarts only because the camera moved
+bool viewChangeOnly = false;
+// edited shaders compile in the background while the previous programs keep rendering
+std::unique_ptr<ProgramBuild> rayTracingBuild;
+std::unique_ptr<ProgramBuild> copyBuild;
 
 std::optional<SSBO> SphereSSBO;
-std::optional<SSBO> TriangleSSBO;
+std::optional<SSBO> PositionSSBO;
+std::optional<SSBO> NormalSSBO;
+std::optional<SSBO> TexcoordSSBO;
+std::optional<SSBO> EnvironmentSSBO;
+std::optional<SSBO> IndexSSBO;
+std::optional<SSBO> BVHNodeSSBO;
 std::optional<SSBO> MeshSSBO;
 std::optional<SSBO> MaterialSSBO;
+std::optional<SSBO> ClusterSSBO;
+std::optional<SSBO> LightSSBO;
+std::optional<SSBO> LightTreeSSBO;
+// material textures, unit 0 is left to the screen texture and the GUI
+std::optional<TextureArrays> MaterialTextures;
 
 constexpr unsigned short SPHERES = 1;
-constexpr unsigned short TRIANGLES = 2;
+constexpr unsigned short GEOMETRY = 2;
 constexpr unsigned short MESHES = 4;
 constexpr unsigned short MATERIALS = 8;
 constexpr unsigned short SYSTEM = 16;
-constexpr unsigned short CAMERA = 32 + TRIANGLES + SPHERES;
+constexpr unsigned short CAMERA = 32;
+constexpr unsigned short RESIDENCY = 64;
+// a live reload already uploaded what changed, only the accumulation restarts
+constexpr unsigned short RELOAD = 128;
+// the emissive surfaces are listed again, e.g. once the loader hands over the geometry
+constexpr unsigned short LIGHTS = 256;
 
 std::vector<unsigned short> ChangesBuffer{};
 
@@ -78,51 +229,40 @@ void FrameBufferResized(GLFWwindow* window, int width, int height)
 	aspectRatio = static_cast<float>(width) / static_cast<float>(height);
 }
 
-void LoadShader(const GLuint shader, const std::vector<const char*> &paths)
+// Builds a program from the fullscreen vertex shader and a fragment shader and waits for it, 0 if it fails
+GLuint CreateProgram(const std::vector<const char*> &fragmentPaths, const std::string &cachePath, const std::string &defines = "")
 {
-	std::vector<std::stringstream> stringStreams(paths.size());
-	std::vector<std::string> sourceCodeStrings(paths.size());
-	std::vector<const char*> sourceCode(paths.size());
-	for (int i = 0; i < paths.size(); ++i)
-	{
-		std::ifstream file(paths[i]);
-		assert(file.is_open());
-		stringStreams[i] << file.rdbuf() << '\0';
-		sourceCodeStrings[i] = stringStreams[i].str();
-		sourceCode[i] = sourceCodeStrings[i].c_str();
-	}
-	glShaderSource(shader, static_cast<int>(sourceCode.size()), sourceCode.data(), nullptr);
-	glCompileShader(shader);
-	GLint success;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-	assert(success);
+	ProgramBuild build({{GL_VERTEX_SHADER, vertexShaderPaths, {}}, {GL_FRAGMENT_SHADER, fragmentPaths, defines}}, cachePath);
+	if (build.Poll(true) == ProgramStatus::FAILED) {
+		std::cout << "Failed to build " << fragmentPaths.back() << ":\n" << build.Log() << std::endl;
+		return 0;
+	}
+	return build.Take();
 }
 
-void LoadMaterials(const char* filePath) {
-	std::ifstream f(filePath);
-	nlohmann::json data = nlohmann::json::parse(f);
-	int idx = 0;
-	for (auto material : data)
-	{
-		materials.push_back(std::make_shared<Material>(Material{
-			{
-				material["albedo"][0].get<float>(),
-				material["albedo"][1].get<float>(),
-				material["albedo"][2].get<float>()
-			},
-			{
-				material["emissionColor"][0].get<float>(),
-				material["emissionColor"][1].get<float>(),
-				material["emissionColor"][2].get<float>()
-			},
-			material["emissionStrength"].get<float>(),
-			material["roughness"].get<float>(),
-			material["metallic"].get<float>(),
-			material["ior"].get<float>(),
-			material["name"].get<std::string>(),
-			idx++
-		}));
-	}
+// Uniform locations change whenever the program is relinked
+void GetRayTracingUniforms()
+{
+	raysLocation = glGetUniformLocation(shaderProgram, "NumRaysPerPixel");
+	bounchesLocation = glGetUniformLocation(shaderProgram, "RayCapacity");
+	lodErrorScaleLocation = glGetUniformLocation(shaderProgram, "LodErrorScale");
+	invProjMatrixLocation = glGetUniformLocation(shaderProgram, "InvProjMatrix");
+	invViewMatrixLocation = glGetUniformLocation(shaderProgram, "InvViewMatrix");
+	frameCountLocation = glGetUniformLocation(shaderProgram, "FrameCount");
+	reservoirSizeLocation = glGetUniformLocation(shaderProgram, "ReservoirSize");
+	residencyFrameLocation = glGetUniformLocation(shaderProgram, "ResidencyFrame");
+	textureBucketsLocation = glGetUniformLocation(shaderProgram, "TextureBuckets");
+	environmentMapLocation = glGetUniformLocation(shaderProgram, "EnvironmentMap");
+	environmentSizeLocation = glGetUniformLocation(shaderProgram, "EnvironmentSize");
+	environmentStrengthLocation = glGetUniformLocation(shaderProgram, "EnvironmentStrength");
+	lightPowerLocation = glGetUniformLocation(shaderProgram, "LightPower");
+
+	// the texture units never change
+	glUseProgram(shaderProgram);
+	const auto textureUnits = MaterialTextures->Units();
+	glUniform1iv(textureBucketsLocation, static_cast<GLsizei>(textureUnits.size()), textureUnits.data());
+	glUniform1iv(environmentMapLocation, 1, &environmentTextureUnit);
+	glUseProgram(0);
 }
 
 void Update(const float deltaTime) {
@@ -198,6 +338,10 @@ void initialise() {
 	glfwMakeContextCurrent(window);
 
 	gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress));
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+		EnableParallelShaderCompile(reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR")));
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+		EnableParallelShaderCompile(reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB")));
 	glfwSetFramebufferSizeCallback(window, FrameBufferResized);
 
 	IMGUI_CHECKVERSION();
@@ -215,9 +359,18 @@ void initialise() {
 	glGenBuffers(1, &VertexBufferObject);
 	glGenVertexArrays(1, &VertexArrayObject);
 	SphereSSBO.emplace(1);
-	TriangleSSBO.emplace(2);
+	PositionSSBO.emplace(2);
 	MeshSSBO.emplace(3);
 	MaterialSSBO.emplace(4);
+	NormalSSBO.emplace(5);
+	IndexSSBO.emplace(6);
+	BVHNodeSSBO.emplace(7);
+	ClusterSSBO.emplace(8);
+	TexcoordSSBO.emplace(9);
+	EnvironmentSSBO.emplace(10);
+	LightSSBO.emplace(16);
+	LightTreeSSBO.emplace(17);
+	MaterialTextures.emplace(1);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObject);
 
@@ -251,41 +404,46 @@ void initialise() {
 	};
 }
 
-void loadResources() {
-	LoadMaterials("resources/materials/materials.json");
-
-	// Creater shader
-	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	LoadShader(vertexShader,{
-		"resources/shaders/version430.glsl",
-		"resources/shaders/renderer/fullscreen.vert"
-	});
-
-	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	LoadShader(fragmentShader, {
-		"resources/shaders/version430.glsl",
-		"resources/shaders/random.glsl",
-		"resources/shaders/raytracing.frag"
-	});
-
-	shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-
-	// get uniforms from shader
-	raysLocation = glGetUniformLocation(shaderProgram, "NumRaysPerPixel");
-	bounchesLocation = glGetUniformLocation(shaderProgram, "RayCapacity");
-	invProjMatrixLocation = glGetUniformLocation(shaderProgram, "InvProjMatrix");
-	frameCountLocation = glGetUniformLocation(shaderProgram, "FrameCount");
+// Loads the HDR environment and its alias table, rays that miss the scene stay black without one.
+// A file that fails to load keeps the current environment.
+bool LoadEnvironment(const char* filePath) {
+	Environment environment;
+	if (!LoadHDR(filePath, environment)) {
+		std::cout << "Failed to load the environment " << filePath << ", rays that miss the scene " <<
+			(environmentSize.x > 0 ? "keep the previous one" : "stay black") << std::endl;
+		return false;
+	}
+	BuildEnvironmentAliasTable(environment);
 
-	// only delete fragment shader as we'll reuse the vertex shader later
-	glDeleteShader(fragmentShader);
+	if (!environmentTexture) glGenTextures(1, &environmentTexture);
+	glActiveTexture(GL_TEXTURE0 + environmentTextureUnit);
+	glBindTexture(GL_TEXTURE_2D, environmentTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, environment.width, environment.height, 0, GL_RGB, GL_FLOAT, environment.radiance.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	EnvironmentSSBO->BufferData(std::span<const AliasEntry>(environment.aliasTable));
+	environmentSize = {environment.width, environment.height};
+	return true;
+}
+
+void loadResources() {
+	// Create shader programs
+	shaderProgram = CreateProgram(rayTracingShaderPaths, PermutationCachePath(rayTracingProgramCachePath, materialFeatures),
+		MaterialFeatureDefines(materialFeatures));
+	assert(shaderProgram);
+	GetRayTracingUniforms();
 
 	// Init Framebuffer
+	screenTextureSize = {screenWidth, screenHeight};
 	glGenTextures(1, &screenTexture);
 	glBindTexture(GL_TEXTURE_2D, screenTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, screenWidth, screenHeight, 0, GL_RGBA, GL_FLOAT, std::span<float>().data());
+	// the sum of every sample traced through a pixel in rgb and how many there were in alpha, the copy pass
+	// divides them. Sums can be added to each other, 32 bit floats keep converging over long renders.
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenWidth, screenHeight, 0, GL_RGBA, GL_FLOAT, std::span<float>().data());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glBindTexture(GL_TEXTURE_2D, 0);
@@ -299,37 +457,338 @@ void loadResources() {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	// Create copy shader
-	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	LoadShader(fragmentShader, {
-		"resources/shaders/version430.glsl",
-		"resources/shaders/renderer/copy.frag"
-	});
-
-	// reusing vertex shader
-	copyShaderProgram = glCreateProgram();
-	glAttachShader(copyShaderProgram, vertexShader);
-	glAttachShader(copyShaderProgram, fragmentShader);
-	glLinkProgram(copyShaderProgram);
-
+	copyShaderProgram = CreateProgram(copyShaderPaths, copyProgramCachePath);
+	assert(copyShaderProgram);
 	sourceTextureLocation = glGetUniformLocation(copyShaderProgram, "SourceTexture");
 
-	glDeleteShader(fragmentShader);
-	glDeleteShader(vertexShader);
+	for (const char *path : vertexShaderPaths) fileWatcher.Watch(path);
+	for (const char *path : rayTracingShaderPaths) fileWatcher.Watch(path);
+	for (const char *path : copyShaderPaths) fileWatcher.Watch(path);
+
+	// Load scene in the background, straight from the binary cache if it was built from the current sources
+	sceneLoader = std::make_unique<SceneLoader>(materialsPath, modelPaths, "resources/cache/scene.rtscene", clusterPoolBytes > 0);
+	sceneLoader->Start();
+
+	spheres.push_back(std::make_shared<Sphere>(glm::vec3(0.5f, 1.0f, -0.2f), 0.4f, 6));
+
+	LoadEnvironment(environmentPath);
+}
+
+// Uploads the batches published by the scene loader, at most sceneUploadBudget bytes per frame so the
+// viewer keeps rendering. A batch's meshes and materials are added once all of its data is on the GPU.
+void StreamScene() {
+	if (!sceneLoader) return;
+
+	size_t budget = sceneUploadBudget;
+	while (budget > 0) {
+		if (!uploadingBatch) {
+			const bool finished = sceneLoader->IsFinished();
+			uploadingBatch = sceneLoader->PopBatch();
+			if (!uploadingBatch) {
+				if (finished) {
+					// everything is uploaded, keep the scene as one geometry on the CPU
+					geometry = sceneLoader->TakeGeometry();
+					sceneCacheFile = sceneLoader->TakeCacheFile();
+					clusters = sceneLoader->TakeClusters();
+					modelRecords = sceneLoader->TakeModels();
+					jsonMaterialCount = sceneLoader->JsonMaterialCount();
+					sceneLoader.reset();
+					// the emissive meshes can be listed now that their triangles are on the CPU
+					ChangesBuffer.push_back(LIGHTS);
+
+					// the sources are only watched once they are loaded, so edits never race the loader
+					fileWatcher.Watch(materialsPath);
+					for (const auto &path : modelPaths) fileWatcher.Watch(path);
+					if (textureLibrary)
+						for (const TextureImage &image : textureLibrary->images) fileWatcher.Watch(image.path);
+					if (!clusters.empty())
+						clusterResidency = std::make_unique<ClusterResidency>(geometry, clusters, clusterPoolBytes,
+							*PositionSSBO, *NormalSSBO, *TexcoordSSBO, *IndexSSBO, *BVHNodeSSBO, *ClusterSSBO);
+				}
+				return;
+			}
+			std::ranges::fill(uploadingOffsets, 0);
+		}
+
+		const Geometry &batchGeometry = uploadingBatch->geometry;
+		const std::span<const std::byte> streams[] = {
+			std::as_bytes(batchGeometry.positions),
+			std::as_bytes(batchGeometry.normals),
+			std::as_bytes(batchGeometry.texcoords),
+			std::as_bytes(batchGeometry.indices),
+			std::as_bytes(batchGeometry.nodes)
+		};
+		SSBO *buffers[] = {&*PositionSSBO, &*NormalSSBO, &*TexcoordSSBO, &*IndexSSBO, &*BVHNodeSSBO};
+		const size_t bases[] = {
+			uploadingBatch->vertexBase * 3 * sizeof(float),
+			uploadingBatch->vertexBase * 3 * sizeof(float),
+			uploadingBatch->vertexBase * 2 * sizeof(float),
+			uploadingBatch->triangleBase * 3 * sizeof(uint32_t),
+			uploadingBatch->nodeBase * sizeof(BVHNode)
+		};
+
+		bool done = true;
+		for (int i = 0; i < 5; ++i) {
+			const size_t size = std::min(streams[i].size() - uploadingOffsets[i], budget);
+			if (uploadingOffsets[i] == 0)
+				buffers[i]->Reserve(bases[i] + streams[i].size());
+			buffers[i]->BufferSubData(bases[i] + uploadingOffsets[i], streams[i].data() + uploadingOffsets[i], size);
+			uploadingOffsets[i] += size;
+			uploadedBytes += size;
+			budget -= size;
+			done &= uploadingOffsets[i] == streams[i].size();
+		}
+		if (!done) return;
+
+		// The render thread owns its own copies, the loader still reads the batch to write the scene cache
+		for (const auto &mesh : uploadingBatch->meshes)
+			meshes.push_back(std::make_shared<Mesh>(*mesh));
+		for (const auto &material : uploadingBatch->materials)
+			materials.push_back(std::make_shared<Material>(*material));
+		if (uploadingBatch->textures) {
+			textureLibrary = uploadingBatch->textures;
+			MaterialTextures->Upload(*textureLibrary);
+		}
+
+		if (!uploadingBatch->meshes.empty()) ChangesBuffer.push_back(MESHES);
+		if (!uploadingBatch->materials.empty()) ChangesBuffer.push_back(MATERIALS);
+		uploadingBatch = nullptr;
+	}
+}
+
+// Starts building the ray tracing program for the current material features, the running one keeps tracing
+void RebuildRayTracingProgram() {
+	rayTracingBuild = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{{GL_VERTEX_SHADER, vertexShaderPaths, {}},
+		{GL_FRAGMENT_SHADER, rayTracingShaderPaths, MaterialFeatureDefines(materialFeatures)}},
+		PermutationCachePath(rayTracingProgramCachePath, materialFeatures));
+}
+
+// The path tracing programs drop the branches of features no material uses, the running ones trace until their
+// permutation is built. Nothing to go by while the first materials are still loading.
+void UpdateMaterialFeatures() {
+	const unsigned features = MaterialFeatures(materials);
+	if (materials.empty() || features == materialFeatures) return;
+	materialFeatures = features;
+	RebuildRayTracingProgram();
+	if (tiled) tiled->SetMaterialFeatures(features);
+}
+
+// Starts rebuilding the programs that use an edited shader, replacing any build of them still in flight
+void ReloadShader(const std::string &path) {
+	auto uses = [&](const std::vector<const char*> &paths) { return std::ranges::find(paths, path) != paths.end(); };
+	const bool vertex = uses(vertexShaderPaths);
+	if (vertex || uses(rayTracingShaderPaths))
+		RebuildRayTracingProgram();
+	if (wavefront) {
+		bool wavefrontStage = false;
+		for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage)
+			wavefrontStage |= uses(wavefront->StagePaths(stage));
+		if (wavefrontStage) wavefront->Rebuild();
+	}
+	if (tiled && uses(tiled->Paths())) tiled->Rebuild();
+	if (temporal && uses(temporal->Paths())) temporal->Rebuild();
+	if (resampledLighting && uses(resampledLighting->Paths())) resampledLighting->Rebuild();
+	if (denoiser && uses(denoiser->Paths())) denoiser->Rebuild();
+	if (vertex || uses(copyShaderPaths))
+		copyBuild = std::make_unique<ProgramBuild>(std::vector<ShaderStage>{
+			{GL_VERTEX_SHADER, vertexShaderPaths, {}}, {GL_FRAGMENT_SHADER, copyShaderPaths, {}}}, copyProgramCachePath);
+}
+
+// Swaps in rebuilt programs once they are linked. A program that fails keeps the previous one running.
+void SwapBuiltPrograms() {
+	if (const ProgramStatus status = rayTracingBuild ? rayTracingBuild->Poll() : ProgramStatus::PENDING; status != ProgramStatus::PENDING) {
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(shaderProgram);
+			shaderProgram = rayTracingBuild->Take();
+			GetRayTracingUniforms();
+			// a new program starts without any uniforms set
+			ChangesBuffer.push_back(SYSTEM);
+			ChangesBuffer.push_back(CAMERA);
+		}
+		else std::cout << "Failed to build the ray tracing shader, keeping the previous one:\n" << rayTracingBuild->Log() << std::endl;
+		rayTracingBuild.reset();
+	}
+	if (const ProgramStatus status = copyBuild ? copyBuild->Poll() : ProgramStatus::PENDING; status != ProgramStatus::PENDING) {
+		if (status == ProgramStatus::READY) {
+			glDeleteProgram(copyShaderProgram);
+			copyShaderProgram = copyBuild->Take();
+			sourceTextureLocation = glGetUniformLocation(copyShaderProgram, "SourceTexture");
+		}
+		else std::cout << "Failed to build the copy shader, keeping the previous one:\n" << copyBuild->Log() << std::endl;
+		copyBuild.reset();
+	}
+	if (wavefront && wavefront->SwapBuiltPrograms())
+		ChangesBuffer.push_back(RELOAD);
+	if (tiled && tiled->SwapBuiltPrograms())
+		ChangesBuffer.push_back(RELOAD);
+	if (temporal && temporal->SwapBuiltPrograms())
+		ChangesBuffer.push_back(RELOAD);
+	if (resampledLighting && resampledLighting->SwapBuiltPrograms())
+		ChangesBuffer.push_back(RELOAD);
+	// the denoiser only filters what is displayed, the accumulation carries on
+	if (denoiser) denoiser->SwapBuiltPrograms();
+}
+
+// Re-parses the materials. Edited materials are uploaded on their own, adding or removing one moves the
+// models' materials behind them and uploads them all.
+void ReloadMaterials() {
+	auto library = std::make_shared<TextureLibrary>();
+	std::vector<std::shared_ptr<Material>> parsed;
+	try {
+		LoadMaterials(materialsPath.c_str(), &parsed, library.get());
+	}
+	catch (const nlohmann::json::exception &error) {
+		// most likely saved halfway through an edit
+		std::cout << "Failed to parse " << materialsPath << ": " << error.what() << std::endl;
+		return;
+	}
+
+	// the texture ids only depend on which images are named, they are only decoded again if that changed
+	auto imagePaths = [](const TextureLibrary &textures) {
+		std::vector<std::string> paths;
+		for (const TextureImage &image : textures.images) paths.push_back(image.path);
+		return paths;
+	};
+	if (!textureLibrary || imagePaths(*library) != imagePaths(*textureLibrary)) {
+		library->Load();
+		MaterialTextures->Upload(*library);
+		textureLibrary = library;
+		for (const TextureImage &image : textureLibrary->images) fileWatcher.Watch(image.path);
+		ChangesBuffer.push_back(RELOAD);
+	}
+
+	if (parsed.size() == jsonMaterialCount) {
+		for (size_t i = 0; i < parsed.size(); ++i) {
+			const auto bytes = parsed[i]->GetBytes();
+			if (bytes == materials[i]->GetBytes() && parsed[i]->name == materials[i]->name) continue;
+			*materials[i] = *parsed[i];
+			MaterialSSBO->BufferSubData(i * bytes.size(), bytes.data(), bytes.size());
+			ChangesBuffer.push_back(RELOAD);
+			ChangesBuffer.push_back(LIGHTS);
+		}
+		// an edit may give a material a feature the programs were built without
+		UpdateMaterialFeatures();
+		return;
+	}
 
-	// Load meshes
-	const char* meshPaths[] = {
-		"resources/models/CornellBox.obj"
+	const auto oldCount = static_cast<int>(jsonMaterialCount), newCount = static_cast<int>(parsed.size());
+	for (size_t i = jsonMaterialCount; i < materials.size(); ++i) {
+		parsed.push_back(materials[i]);
+		parsed.back()->index = static_cast<int>(parsed.size() - 1);
+	}
+	// meshes and spheres using a removed material fall back to the first one
+	auto remap = [&](int &materialIndex) {
+		if (materialIndex >= oldCount)
+			materialIndex += newCount - oldCount;
+		else if (materialIndex >= newCount)
+			materialIndex = 0;
 	};
-	for (const auto path: meshPaths)
-		for (const auto& mesh : loadMesh(path, &triangles))
-			meshes.push_back(mesh);
+	for (const auto &mesh : meshes) remap(mesh->materialIndex);
+	for (const auto &sphere : spheres) remap(sphere->materialIndex);
+	for (ModelRecord &record : modelRecords)
+		record.firstMaterial = static_cast<uint32_t>(static_cast<int>(record.firstMaterial) + newCount - oldCount);
+	jsonMaterialCount = parsed.size() - (materials.size() - jsonMaterialCount);
+	materials = std::move(parsed);
+	ChangesBuffer.push_back(MATERIALS);
+	ChangesBuffer.push_back(MESHES);
+	ChangesBuffer.push_back(SPHERES);
+}
 
-	constexpr int indices[]{5, 4, 0, 3, 2, 4, 1, 7, 8};
-	for (int i = 0; i < meshes.size(); ++i) {
-		meshes[i]->materialIndex = indices[i];
+// Re-loads a single model and uploads the parts of the streams that changed. Clustered scenes are paged in
+// from clusters built over the whole scene and can't swap a model.
+void ReloadModel(size_t modelIndex) {
+	const std::string &path = modelPaths[modelIndex];
+	const auto record = std::ranges::find(modelRecords, static_cast<uint32_t>(modelIndex), &ModelRecord::modelIndex);
+	if (record == modelRecords.end() || !std::filesystem::exists(path)) {
+		std::cout << "Can't reload " << path << std::endl;
+		return;
+	}
+	const uint32_t firstMaterial = record->firstMaterial, materialCount = record->materialCount;
+	const std::vector jsonMaterials(materials.begin(), materials.begin() + static_cast<std::ptrdiff_t>(jsonMaterialCount));
+	const auto batch = LoadModelBatch(path.c_str(), jsonMaterials);
+	const ModelReload reload = ReplaceModel(geometry, meshes, modelRecords, record - modelRecords.begin(), *batch);
+
+	const std::span<const std::byte> streams[] = {
+		std::as_bytes(geometry.positions),
+		std::as_bytes(geometry.normals),
+		std::as_bytes(geometry.texcoords),
+		std::as_bytes(geometry.indices),
+		std::as_bytes(geometry.nodes)
+	};
+	SSBO *buffers[] = {&*PositionSSBO, &*NormalSSBO, &*TexcoordSSBO, &*IndexSSBO, &*BVHNodeSSBO};
+	for (int i = 0; i < GEOMETRY_STREAM_COUNT; ++i) {
+		const StreamRange &range = reload.streams[i];
+		if (range.size == 0) continue;
+		buffers[i]->Reserve(streams[i].size());
+		buffers[i]->BufferSubData(range.offset, streams[i].data() + range.offset, range.size);
 	}
 
-	spheres.push_back(std::make_shared<Sphere>(glm::vec3(0.5f, 1.0f, -0.2f), 0.4f, 6));
+	// the model's own materials only fit if it still has as many
+	if (!batch->materials.empty() && batch->materials.size() == materialCount) {
+		for (size_t i = 0; i < materialCount; ++i) {
+			*materials[firstMaterial + i] = *batch->materials[i];
+			const auto bytes = materials[firstMaterial + i]->GetBytes();
+			MaterialSSBO->BufferSubData((firstMaterial + i) * bytes.size(), bytes.data(), bytes.size());
+		}
+		UpdateMaterialFeatures();
+	}
+
+	if (reload.meshCountChanged)
+		ChangesBuffer.push_back(MESHES);
+	else if (reload.firstDirtyMesh < reload.dirtyMeshEnd) {
+		std::vector<std::byte> bytes;
+		for (size_t i = reload.firstDirtyMesh; i < reload.dirtyMeshEnd; ++i) {
+			const auto meshBytes = meshes[i]->GetBytes();
+			bytes.insert(bytes.end(), meshBytes.begin(), meshBytes.end());
+		}
+		const size_t stride = bytes.size() / (reload.dirtyMeshEnd - reload.firstDirtyMesh);
+		MeshSSBO->BufferSubData(reload.firstDirtyMesh * stride, bytes.data(), bytes.size());
+	}
+	ChangesBuffer.push_back(RELOAD);
+	ChangesBuffer.push_back(LIGHTS);
+}
+
+// Decodes an edited texture again and replaces its layer, it keeps the size it was given when first loaded
+void ReloadTexture(TextureImage &image) {
+	TextureLibrary::Decode(image);
+	MaterialTextures->UploadImage(image);
+	ChangesBuffer.push_back(RELOAD);
+}
+
+// Applies edits to the scene sources and shaders, re-parsing only the edited file and uploading only what it changed
+void HandleFileChanges() {
+	for (const std::string &path : fileWatcher.Poll()) {
+		const auto model = std::ranges::find(modelPaths, path);
+		TextureImage *image = nullptr;
+		if (textureLibrary)
+			for (TextureImage &texture : textureLibrary->images)
+				if (texture.path == path) image = &texture;
+
+		if (path == materialsPath) ReloadMaterials();
+		else if (model != modelPaths.end()) ReloadModel(model - modelPaths.begin());
+		else if (image) ReloadTexture(*image);
+		else ReloadShader(path);
+	}
+}
+
+void ShowResidency() {
+	if (!clusterResidency) return;
+	ImGui::Begin("Residency");
+	ImGui::Text("clusters: %zu", clusterResidency->ClusterCount());
+	ImGui::Text("resident: %zu / %zu slots", clusterResidency->ResidentCount(), clusterResidency->SlotCount());
+	ImGui::Text("missing: %zu", clusterResidency->MissingCount());
+	ImGui::End();
+}
+
+void ShowLoadingProgress() {
+	if (!sceneLoader) return;
+	ImGui::Begin("Loading");
+	ImGui::Text("%s", sceneLoader->Status().c_str());
+	ImGui::ProgressBar(sceneLoader->Progress(), ImVec2(-1.0f, 0.0f), "parsing");
+	const size_t publishedBytes = sceneLoader->PublishedBytes();
+	ImGui::ProgressBar(publishedBytes > 0 ? static_cast<float>(uploadedBytes) / static_cast<float>(publishedBytes) : 0.0f,
+		ImVec2(-1.0f, 0.0f), "uploading");
+	ImGui::End();
 }
 
 bool MaterialDropDown(int &materialIndex) {
@@ -381,10 +840,51 @@ void RenderGUI() {
 	bool meshChanges = false;
 
 	ShowMatricies();
+	ShowLoadingProgress();
+	ShowResidency();
 
 	ImGui::Begin("Ray tracing");
 	systemhanges |= ImGui::DragInt("Rays per Pixel", &numberOfRays, 1, 0);
 	systemhanges |= ImGui::DragInt("Bounces", &numberOfbounches, 1, 0);
+	systemhanges |= ImGui::DragFloat("LOD Error Scale", &lodErrorScale, 0.05f, 0);
+	constexpr const char *renderModes[] = {"Fragment", "Wavefront", "Tiled"};
+	systemhanges |= ImGui::Combo("Renderer", &renderMode, renderModes, IM_ARRAYSIZE(renderModes));
+	if (renderMode == TILED_RENDER) {
+		systemhanges |= ImGui::Checkbox("Adaptive Sampling", &adaptiveSampling.enabled);
+		if (adaptiveSampling.enabled) {
+			systemhanges |= ImGui::DragFloat("Error Target", &adaptiveSampling.errorTarget, 0.001f, 0.001f, 1.0f);
+			systemhanges |= ImGui::DragInt("Sample Limit", &adaptiveSampling.sampleLimit, 16, 1);
+			if (tiled && tiled->ActiveTiles() == 0)
+				ImGui::Text("converged");
+			else if (tiled && tiled->ActiveTiles() != UINT32_MAX)
+				ImGui::Text("tracing: %u tiles", tiled->ActiveTiles());
+		}
+	}
+	ImGui::InputText("Environment", environmentPath, sizeof(environmentPath));
+	ImGui::SameLine();
+	if (ImGui::Button("Load"))
+		systemhanges |= LoadEnvironment(environmentPath);
+	if (environmentSize.x > 0)
+		systemhanges |= ImGui::DragFloat("Environment Strength", &environmentStrength, 0.05f, 0);
+	systemhanges |= ImGui::Checkbox("Temporal Reprojection", &temporalReprojection);
+	if (temporalReprojection)
+		systemhanges |= ImGui::DragInt("History Length", &historyLength, 1, 1);
+	systemhanges |= ImGui::Checkbox("Resampled Lighting", &resampling.enabled);
+	if (resampling.enabled) {
+		systemhanges |= ImGui::DragInt("Light Candidates", &resampling.candidates, 1, 1, 256);
+		systemhanges |= ImGui::Checkbox("Temporal Reuse", &resampling.temporalReuse);
+		if (resampling.temporalReuse)
+			systemhanges |= ImGui::DragFloat("Reuse Limit", &resampling.temporalLimit, 0.5f, 1.0f, 100.0f);
+		systemhanges |= ImGui::DragInt("Spatial Samples", &resampling.spatialSamples, 0.1f, 0, 16);
+		systemhanges |= ImGui::DragFloat("Spatial Radius", &resampling.spatialRadius, 0.5f, 1.0f, 100.0f);
+		systemhanges |= ImGui::Checkbox("Spatial Visibility", &resampling.spatialVisibility);
+	}
+	// the denoiser filters the display only, changing it doesn't restart the accumulation
+	ImGui::Checkbox("Denoise", &denoiseSettings.enabled);
+	if (denoiseSettings.enabled) {
+		ImGui::DragInt("Denoise Passes", &denoiseSettings.passes, 0.1f, 1, 8);
+		ImGui::DragFloat("Denoise Color Phi", &denoiseSettings.colorPhi, 0.01f, 0.001f, 100.0f);
+	}
 	ImGui::End();
 	ImGui::Begin("Materials");
 	for (const auto &material : materials) {
@@ -411,12 +911,15 @@ void RenderGUI() {
 	}
 	ImGui::End();
 	ImGui::Begin("Meshes");
-	for (const auto &mesh : meshes) {
-		if (ImGui::TreeNodeEx(mesh->name.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
-			meshChanges |= ImGui::Checkbox("Hide", &mesh->visible);
-			meshChanges |= MaterialDropDown(mesh->materialIndex);
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		// instances can share a name
+		ImGui::PushID(static_cast<int>(i));
+		if (ImGui::TreeNodeEx(meshes[i]->name.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
+			meshChanges |= ImGui::Checkbox("Hide", &meshes[i]->visible);
+			meshChanges |= MaterialDropDown(meshes[i]->materialIndex);
 			ImGui::TreePop();
 		}
+		ImGui::PopID();
 	}
 	ImGui::End();
 
@@ -431,19 +934,24 @@ void RenderGUI() {
 
 void HandleChanges() {
 	if(ChangesBuffer.empty()) return;
-	const unsigned short change = std::accumulate(std::begin(ChangesBuffer), std::end(ChangesBuffer), 0);
+	// the same change may be pushed several times a frame
+	const unsigned short change = std::accumulate(std::begin(ChangesBuffer), std::end(ChangesBuffer), 0, std::bit_or<>());
+	// newly resident clusters only let samples through that were deferred until now, what the pixels accumulated
+	// is still right and the accumulation carries on
+	const unsigned short restart = change & ~RESIDENCY;
 
 	if (change & SPHERES) {
 		std::vector<std::shared_ptr<ShaderStruct>> _spheres;
-		for (const auto &sphere: spheres)
-			_spheres.push_back(std::make_shared<Sphere>(sphere->Transform(camera.viewMatrix)));
+		for (const auto &sphere: spheres)_spheres.push_back(sphere);
 		SphereSSBO->BufferData(_spheres);
 	}
-	if (change & TRIANGLES) {
-		std::vector<std::shared_ptr<ShaderStruct>> _triangles;
-		for (const auto &triangle: triangles)
-			_triangles.push_back(std::make_shared<Triangle>(triangle->Transform(camera.viewMatrix)));
-		TriangleSSBO->BufferData(_triangles);
+	// clustered geometry is paged in by the residency manager
+	if (change & GEOMETRY && !clusterResidency) {
+		PositionSSBO->BufferData(geometry.positions);
+		NormalSSBO->BufferData(geometry.normals);
+		TexcoordSSBO->BufferData(geometry.texcoords);
+		IndexSSBO->BufferData(geometry.indices);
+		BVHNodeSSBO->BufferData(geometry.nodes);
 	}
 	if (change & MESHES) {
 		std::vector<std::shared_ptr<ShaderStruct>> _meshes;
@@ -454,19 +962,51 @@ void HandleChanges() {
 		std::vector<std::shared_ptr<ShaderStruct>> _materials;
 		for (const auto &material: materials)_materials.push_back(material);
 		MaterialSSBO->BufferData(_materials);
+		UpdateMaterialFeatures();
+	}
+	if (change & (SPHERES | GEOMETRY | MESHES | MATERIALS | LIGHTS)) {
+		const LightList lightList = BuildLightList(spheres, meshes, materials, geometry, clusters);
+		LightSSBO->BufferData(std::span<const EmissiveLight>(lightList.lights));
+		LightTreeSSBO->BufferData(std::span<const LightNode>(lightList.nodes));
+		lightPower = lightList.power;
+		glUniform1f(lightPowerLocation, lightPower);
 	}
 	if (change & SYSTEM) {
 		glUniform1iv(raysLocation, 1, &numberOfRays);
 		glUniform1iv(bounchesLocation, 1, &numberOfbounches);
+		glUniform1f(lodErrorScaleLocation, lodErrorScale);
+		glUniform2iv(environmentSizeLocation, 1, &environmentSize[0]);
+		glUniform1f(environmentStrengthLocation, environmentStrength);
+		glUniform1f(lightPowerLocation, lightPower);
 	}
 	if (change & CAMERA) {
 		glUniformMatrix4fv(invProjMatrixLocation, 1, false, &inverse(camera.projMatrix)[0][0]);
+		glUniformMatrix4fv(invViewMatrixLocation, 1, false, &inverse(camera.viewMatrix)[0][0]);
 	}
 	ChangesBuffer.clear();
+	if (!restart) return;
+	viewChangeOnly = restart == CAMERA;
 	frameCount = 0;
 }
 
-int main() {
+// Reads the command line options, returns false on one it doesn't know
+bool ParseArguments(int argc, char *argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view argument = argv[i];
+		if (argument == "--cluster-pool" && i + 1 < argc)
+			clusterPoolBytes = std::strtoull(argv[++i], nullptr, 10) << 20;
+		else if (argument == "--environment" && i + 1 < argc)
+			std::snprintf(environmentPath, sizeof(environmentPath), "%s", argv[++i]);
+		else {
+			std::cout << "Unknown option " << argument << "\nUsage: rayTracer [--cluster-pool <MiB>] [--environment <file.hdr>]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (!ParseArguments(argc, argv)) return 1;
 	initialise();
 	loadResources();
 	// Start Program
@@ -510,31 +1050,92 @@ int main() {
 
 		glClear(mask);
 
+		HandleFileChanges();
+		SwapBuiltPrograms();
+
 		glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer);
 		glUseProgram(shaderProgram);
 
+		StreamScene();
+		if (clusterResidency && clusterResidency->Update(sceneUploadBudget))
+			ChangesBuffer.push_back(RESIDENCY);
 		HandleChanges();
 
 		glUniform1uiv(frameCountLocation, 1, &++frameCount);
-
-		// Set depth test
-		glDepthFunc(GL_LESS);
-		glDepthMask(GL_TRUE);
-		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-		glStencilFunc(GL_NEVER, 0, UINT_MAX);
-		glEnable(GL_BLEND);
-		glBlendEquation(GL_FUNC_ADD);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-		glBindVertexArray(VertexArrayObject);
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		const glm::ivec2 reservoirSize = resampling.enabled ? screenTextureSize : glm::ivec2(0);
+		glUniform2iv(reservoirSizeLocation, 1, &reservoirSize[0]);
+		const GLuint residencyFrame = clusterResidency ? clusterResidency->Frame() : 0;
+		if (clusterResidency)
+			glUniform1uiv(residencyFrameLocation, 1, &residencyFrame);
+
+		const ComputeFrame computeFrame{
+			inverse(camera.projMatrix), inverse(camera.viewMatrix), frameCount, residencyFrame,
+			numberOfRays, numberOfbounches, lodErrorScale, environmentSize, environmentStrength, lightPower,
+			MaterialTextures->Units(), environmentTextureUnit, reservoirSize
+		};
+		// the accumulation starts over, from what the previous view still shows or from an empty sum
+		if (frameCount == 1) {
+			if (!temporal) {
+				temporal = std::make_unique<TemporalReprojection>(reprojectShaderPaths, screenTextureSize);
+				for (const char *path : temporal->Paths()) fileWatcher.Watch(path);
+			}
+			temporal->Restart(screenTexture, computeFrame, camera.projMatrix * camera.viewMatrix,
+				temporalReprojection && viewChangeOnly, static_cast<float>(historyLength));
+			glUseProgram(shaderProgram);
+		}
+		// every frame adds candidates to the first hits' reservoirs, camera moves carry them over to the new view
+		if (resampling.enabled) {
+			if (!resampledLighting) {
+				resampledLighting = std::make_unique<ResampledLighting>(resampleShaderPaths, screenTextureSize);
+				for (const char *path : resampledLighting->Paths()) fileWatcher.Watch(path);
+			}
+			resampledLighting->Resample(computeFrame, *temporal, resampling, viewChangeOnly);
+			glUseProgram(shaderProgram);
+		}
+		if (renderMode == WAVEFRONT_RENDER) {
+			if (!wavefront) {
+				wavefront = std::make_unique<WavefrontRenderer>(wavefrontShaderPaths);
+				for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; ++stage)
+					for (const char *path : wavefront->StagePaths(stage)) fileWatcher.Watch(path);
+			}
+			wavefront->Render(screenTexture, screenTextureSize, computeFrame);
+		}
+		else if (renderMode == TILED_RENDER) {
+			if (!tiled) {
+				tiled = std::make_unique<TiledRenderer>(tiledShaderPaths, materialFeatures);
+				for (const char *path : tiled->Paths()) fileWatcher.Watch(path);
+			}
+			tiled->Render(screenTexture, screenTextureSize, computeFrame, adaptiveSampling);
+		}
+		else {
+			// Set depth test
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+			glStencilFunc(GL_NEVER, 0, UINT_MAX);
+			glEnable(GL_BLEND);
+			glBlendEquation(GL_FUNC_ADD);
+			glBlendFunc(GL_ONE, GL_ONE);
+
+			glBindVertexArray(VertexArrayObject);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+		GLuint displayTexture = screenTexture;
+		if (denoiseSettings.enabled) {
+			if (!denoiser) {
+				denoiser = std::make_unique<Denoiser>(denoiseShaderPaths, screenTextureSize);
+				for (const char *path : denoiser->Paths()) fileWatcher.Watch(path);
+			}
+			displayTexture = denoiser->Denoise(screenTexture, temporal->FirstHit(), temporal->FirstHitNormal(), temporal->FirstHitAlbedo(), denoiseSettings);
+		}
+
 		glUseProgram(copyShaderProgram);
 
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, screenTexture);
+		glBindTexture(GL_TEXTURE_2D, displayTexture);
 		glUniform1iv(sourceTextureLocation, 1, &screenTexturePtr);
 
 		glDepthFunc(GL_LESS);